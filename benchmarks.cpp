@@ -0,0 +1,360 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bimap.h"
+#include "sharded_bimap.h"
+
+namespace {
+
+constexpr uint32_t key_space = 1 << 20;
+constexpr size_t total_ops = 1000000;
+
+// Right keys are a bijection of left keys, so reads can hit both sides.
+uint32_t right_of(uint32_t left) {
+  return left * 2654435761u;
+}
+
+struct locked_bimap {
+  std::mutex mutex;
+  bimap<uint32_t, uint32_t> map;
+
+  bool insert(uint32_t l, uint32_t r) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return map.insert(l, r) != map.end_left();
+  }
+
+  bool erase_left(uint32_t l) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return map.erase_left(l);
+  }
+
+  bool find_left(uint32_t l) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return map.find_left(l) != map.end_left();
+  }
+
+  bool find_right(uint32_t r) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return map.find_right(r) != map.end_right();
+  }
+};
+
+struct sharded {
+  sharded_bimap<uint32_t, uint32_t, 64> map;
+
+  bool insert(uint32_t l, uint32_t r) {
+    return map.insert(l, r);
+  }
+
+  bool erase_left(uint32_t l) {
+    return map.erase_left(l);
+  }
+
+  bool find_left(uint32_t l) {
+    return map.find_left(l).has_value();
+  }
+
+  bool find_right(uint32_t r) {
+    return map.find_right(r).has_value();
+  }
+};
+
+// Runs total_ops operations split over threads; write_percent of them are
+// inserts or erases, the rest are lookups by either side.
+template <class Map>
+double run(size_t threads, unsigned write_percent) {
+  Map m;
+  for (uint32_t i = 0; i < key_space; i += 2) {
+    m.insert(i, right_of(i));
+  }
+  std::vector<std::thread> workers;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t t = 0; t < threads; t++) {
+    workers.emplace_back([&m, t, threads, write_percent] {
+      std::mt19937 e(static_cast<uint32_t>(t));
+      size_t hits = 0;
+      for (size_t i = 0; i < total_ops / threads; i++) {
+        uint32_t key = e() % key_space;
+        unsigned op = e() % 100;
+        if (op < write_percent / 2) {
+          hits += m.insert(key, right_of(key));
+        } else if (op < write_percent) {
+          hits += m.erase_left(key);
+        } else if (op % 2 == 0) {
+          hits += m.find_left(key);
+        } else {
+          hits += m.find_right(right_of(key));
+        }
+      }
+      static std::atomic<size_t> sink{0};
+      sink += hits;
+    });
+  }
+  for (auto& w : workers) {
+    w.join();
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return total_ops / elapsed.count() / 1e6;
+}
+
+void sharded_scaling() {
+  std::printf("sharded_bimap vs bimap + mutex, Mops/s\n");
+  std::printf("%8s %8s %12s %12s\n", "threads", "writes", "locked", "sharded");
+  for (unsigned writes : {0u, 10u, 50u}) {
+    for (size_t threads : {1, 2, 4, 8, 16, 32, 64}) {
+      std::printf("%8zu %7u%% %12.2f %12.2f\n", threads, writes,
+                  run<locked_bimap>(threads, writes),
+                  run<sharded>(threads, writes));
+    }
+  }
+}
+
+constexpr size_t string_keys = 1 << 18;
+
+// Same order as std::less<std::string>, but not recognized by key_cache, so
+// every comparison reads both strings.
+struct uncached_less {
+  bool operator()(std::string const& a, std::string const& b) const {
+    return a < b;
+  }
+};
+
+std::vector<std::string> uuid_keys(std::mt19937& e) {
+  std::vector<std::string> keys;
+  const char* hex = "0123456789abcdef";
+  for (size_t i = 0; i < string_keys; i++) {
+    std::string key;
+    for (size_t j = 0; j < 32; j++) {
+      if (j == 8 || j == 12 || j == 16 || j == 20) {
+        key += '-';
+      }
+      key += hex[e() % 16];
+    }
+    keys.push_back(key);
+  }
+  return keys;
+}
+
+std::vector<std::string> url_keys(std::mt19937& e) {
+  std::vector<std::string> keys;
+  const char* hosts[] = {"https://example.com", "https://cdn.example.net",
+                         "http://api.test.org", "https://www.shop.io"};
+  const char* paths[] = {"/users/", "/items/", "/static/img/", "/search?q="};
+  for (size_t i = 0; i < string_keys; i++) {
+    keys.push_back(std::string(hosts[e() % 4]) + paths[e() % 4] +
+                   std::to_string(e() % 100000000) + "/" + std::to_string(i));
+  }
+  return keys;
+}
+
+// Lookups of random present keys, Mops/s.
+template <class Compare>
+double string_lookups(std::vector<std::string> const& keys) {
+  bimap<std::string, uint32_t, Compare> map;
+  for (size_t i = 0; i < keys.size(); i++) {
+    map.insert(keys[i], static_cast<uint32_t>(i));
+  }
+  std::mt19937 e(7);
+  size_t hits = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < total_ops; i++) {
+    hits += map.find_left(keys[e() % keys.size()]) != map.end_left();
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  static std::atomic<size_t> sink{0};
+  sink += hits;
+  return total_ops / elapsed.count() / 1e6;
+}
+
+void string_prefix_cache() {
+  std::mt19937 e(1);
+  std::printf("string keys: prefix cache vs full compares, Mops/s\n");
+  std::printf("%8s %12s %12s\n", "keys", "uncached", "cached");
+  auto uuids = uuid_keys(e);
+  std::printf("%8s %12.2f %12.2f\n", "uuid",
+              string_lookups<uncached_less>(uuids),
+              string_lookups<std::less<std::string>>(uuids));
+  auto urls = url_keys(e);
+  std::printf("%8s %12.2f %12.2f\n", "url",
+              string_lookups<uncached_less>(urls),
+              string_lookups<std::less<std::string>>(urls));
+}
+
+constexpr size_t zipf_keys = 1 << 20;
+
+size_t zipf_compares = 0;
+
+struct zipf_counting_less {
+  bool operator()(uint32_t a, uint32_t b) const {
+    zipf_compares++;
+    return a < b;
+  }
+};
+
+// Popularity ranks drawn from Zipf(0.99) over [0, zipf_keys).
+std::vector<uint32_t> zipf_ranks(std::mt19937& e, size_t count) {
+  std::vector<double> cdf(zipf_keys);
+  double sum = 0;
+  for (size_t i = 0; i < zipf_keys; i++) {
+    sum += 1 / std::pow(double(i + 1), 0.99);
+    cdf[i] = sum;
+  }
+  std::uniform_real_distribution<double> uniform(0, sum);
+  std::vector<uint32_t> ranks(count);
+  for (auto& rank : ranks) {
+    rank = static_cast<uint32_t>(
+        std::lower_bound(cdf.begin(), cdf.end(), uniform(e)) - cdf.begin());
+  }
+  return ranks;
+}
+
+// The key of a rank; hot keys are spread over the key space.
+uint32_t zipf_key(uint32_t rank) {
+  return right_of(rank) % key_space;
+}
+
+void skewed_lookups() {
+  std::mt19937 e(11);
+  auto ranks = zipf_ranks(e, total_ops);
+  std::printf("Zipf(0.99) lookups over %zu keys, compares per lookup\n",
+              zipf_keys);
+  std::printf("%10s %10s %10s %10s\n", "mode", "Mops/s", "all", "top 64");
+  for (size_t budget : {0, 2, 4, 8}) {
+    bimap<uint32_t, uint32_t, zipf_counting_less> map;
+    for (uint32_t i = 0; i < zipf_keys; i++) {
+      map.insert(zipf_key(i), i);
+    }
+    map.enable_adaptive_lookups(budget);
+    size_t hits = 0;
+    for (size_t i = 0; i < total_ops / 10; i++) {
+      hits += map.find_left(zipf_key(ranks[i])) != map.end_left();
+    }
+    zipf_compares = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (auto rank : ranks) {
+      hits += map.find_left(zipf_key(rank)) != map.end_left();
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    size_t all = zipf_compares;
+    zipf_compares = 0;
+    for (uint32_t rank = 0; rank < 64; rank++) {
+      hits += map.find_left(zipf_key(rank)) != map.end_left();
+    }
+    static std::atomic<size_t> sink{0};
+    sink += hits;
+    char mode[16];
+    std::snprintf(mode, sizeof(mode), budget == 0 ? "static" : "budget %zu",
+                  budget);
+    std::printf("%10s %10.2f %10.1f %10.1f\n", mode,
+                ranks.size() / elapsed.count() / 1e6,
+                double(all) / double(ranks.size()), zipf_compares / 64.0);
+  }
+}
+
+struct scan_tag {};
+
+struct scan_node : IntrusiveNode<scan_tag> {
+  uint32_t key = 0;
+};
+
+struct scan_key_of {
+  const uint32_t& operator()(const IntrusiveNode<scan_tag>* node) const {
+    return static_cast<const scan_node*>(node)->key;
+  }
+
+  static key_cache<uint32_t, void> cache(const IntrusiveNode<scan_tag>*) {
+    return {};
+  }
+};
+
+using scan_hook = IntrusiveNode<scan_tag>;
+
+// The successor as a tree without threads finds it: the leftmost node of
+// the right subtree, or the first ancestor reached from a left subtree.
+const scan_hook* walk_next(const scan_hook* node) {
+  if (node->right != nullptr) {
+    node = node->right;
+    while (node->left != nullptr) {
+      node = node->left;
+    }
+    return node;
+  }
+  while (node->top->right == node) {
+    node = node->top;
+  }
+  return node->top;
+}
+
+// ns per element of a full in-order scan, following threads or walking.
+template <class Next>
+double scan(const scan_hook* first, const scan_hook* end, Next next) {
+  uint64_t sum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (auto node = first; node != end; node = next(node)) {
+    sum += static_cast<const scan_node*>(node)->key;
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  static std::atomic<uint64_t> sink{0};
+  sink += sum;
+  return elapsed.count() * 1e9;
+}
+
+// What the in-order threads cost in memory and buy in full scans. They are
+// not optional: begin(), the append path, finger searches and joins read
+// them as well as iterators.
+void threaded_scans() {
+  std::printf("in-order threads: bytes per pair and full scan, ns/elem\n");
+  std::printf("%10s %10s %10s %10s %10s\n", "keys", "hook", "pair",
+              "threads", "walk");
+  for (uint32_t count : {1u << 10, 1u << 16, 1u << 20}) {
+    std::vector<scan_node> nodes(count);
+    std::vector<uint32_t> order(count);
+    for (uint32_t i = 0; i < count; i++) {
+      order[i] = i;
+    }
+    std::mt19937 e(5);
+    std::shuffle(order.begin(), order.end(), e);
+    scan_hook head;
+    IntrusiveCartesianTree<scan_tag, uint32_t, std::less<uint32_t>,
+                           scan_key_of>
+        tree(&head);
+    for (uint32_t i = 0; i < count; i++) {
+      nodes[i].key = order[i];
+      tree.insert(&nodes[i]);
+    }
+    double threads = 0;
+    double walk = 0;
+    for (int round = 0; round < 5; round++) {
+      threads += scan(tree.begin(), tree.end(),
+                      [](const scan_hook* node) { return node->next(); });
+      walk += scan(tree.begin(), tree.end(), walk_next);
+    }
+    std::printf("%10u %10zu %10zu %10.2f %10.2f\n", count, sizeof(scan_hook),
+                sizeof(Node<uint32_t, uint32_t>), threads / 5 / count,
+                walk / 5 / count);
+  }
+  std::printf("without threads a hook is %zu bytes smaller\n",
+              2 * sizeof(scan_hook*));
+}
+
+} // namespace
+
+int main() {
+  sharded_scaling();
+  string_prefix_cache();
+  skewed_lookups();
+  threaded_scans();
+}
@@ -1,50 +1,630 @@
 #pragma once
+#include "bimap_delta.h"
 #include "intrusive_cartesian_tree.h"
+#include "key_filter.h"
+#include <algorithm>
+#include <atomic>
 #include <climits>
 #include <cstddef>
+#include <functional>
 #include <list>
+#include <memory>
+#include <new>
 #include <set>
+#include <stdexcept>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
-struct LeftTag {};
-struct RightTag {};
+using LeftTag = IndexTag<0>;
+using RightTag = IndexTag<1>;
 
-struct NodeHead : public IntrusiveNode<LeftTag>,
-                  public IntrusiveNode<RightTag> {
-  NodeHead() : IntrusiveNode<LeftTag>(), IntrusiveNode<RightTag>() {}
+using NodeHead = MultiIndexHead<std::index_sequence<0, 1>>;
+
+// Augmentation policy of a side that keeps nothing, the default.
+struct no_augment {};
+
+// Aggregate of the subtree of a node in the tree of side Tag under an
+// augmentation policy, a monoid over the pairs:
+//
+//   struct sum_of_right {
+//     using value_type = long long;
+//     static value_type identity() { return 0; }
+//     static value_type of(const int& left, const int& right) { return right; }
+//     static value_type combine(value_type a, value_type b) { return a + b; }
+//   };
+//
+// combine has to be associative and gets its arguments in key order.
+template <class Tag, class Augment>
+struct NodeAggregate {
+  typename Augment::value_type aggregate = Augment::identity();
 };
 
-template <class Left, class Right>
-struct Node : public NodeBase<Left, LeftTag>, public NodeBase<Right, RightTag> {
+template <class Tag>
+struct NodeAggregate<Tag, no_augment> {};
+
+// The MultiIndexNode of the two sides followed by the aggregates, so a node
+// is a single block without a vptr; hooks are converted to the node with
+// static casts only. Empty caches and aggregates take no space.
+template <class Left, class Right, class CompareLeft = std::less<Left>,
+          class CompareRight = std::less<Right>,
+          class AugmentLeft = no_augment, class AugmentRight = no_augment>
+struct Node : public MultiIndexNode<std::index_sequence<0, 1>,
+                                    unique_key<Left, CompareLeft>,
+                                    unique_key<Right, CompareRight>>,
+              public NodeAggregate<LeftTag, AugmentLeft>,
+              public NodeAggregate<RightTag, AugmentRight> {
+  using base_t =
+      MultiIndexNode<std::index_sequence<0, 1>, unique_key<Left, CompareLeft>,
+                     unique_key<Right, CompareRight>>;
+  using left_augment = AugmentLeft;
+  using right_augment = AugmentRight;
 
   template <class LeftArg = Left, class RightArg = Right>
   Node(LeftArg&& left, RightArg&& right)
-      : NodeBase<Left, LeftTag>(std::forward<LeftArg>(left)),
-        NodeBase<Right, RightTag>(std::forward<RightArg>(right)) {}
+      : base_t(std::forward<LeftArg>(left), std::forward<RightArg>(right)) {}
+
+  Left& left_value() {
+    return std::get<0>(this->keys);
+  }
+
+  const Left& left_value() const {
+    return std::get<0>(this->keys);
+  }
+
+  Right& right_value() {
+    return std::get<1>(this->keys);
+  }
+
+  const Right& right_value() const {
+    return std::get<1>(this->keys);
+  }
+};
+
+template <class Node, class Tag>
+struct NodeKeyOf {
+  decltype(auto) operator()(const IntrusiveNode<Tag>* node) const {
+    return Node::value_of(node);
+  }
+
+  static decltype(auto) cache(const IntrusiveNode<Tag>* node) {
+    return Node::cache_of(node);
+  }
+};
+
+// The Augment of IntrusiveCartesianTree for one side of Node.
+template <class Node, class Tag, class Augment>
+struct NodeAugment {
+  using value_type = typename Augment::value_type;
+  using storage_t = NodeAggregate<Tag, Augment>;
+
+  static const Node& node_of(const IntrusiveNode<Tag>* node) {
+    return static_cast<const Node&>(static_cast<const NodeHead&>(*node));
+  }
+
+  static value_type identity() {
+    return Augment::identity();
+  }
+
+  static value_type combine(const value_type& a, const value_type& b) {
+    return Augment::combine(a, b);
+  }
+
+  static value_type single(const IntrusiveNode<Tag>* node) {
+    return Augment::of(node_of(node).left_value(), node_of(node).right_value());
+  }
+
+  static const value_type& subtree(const IntrusiveNode<Tag>* node) {
+    return static_cast<const storage_t&>(node_of(node)).aggregate;
+  }
+
+  static void store(IntrusiveNode<Tag>* node, value_type value) {
+    static_cast<storage_t&>(const_cast<Node&>(node_of(node))).aggregate =
+        std::move(value);
+  }
 };
 
+template <class Node, class Tag, class Augment>
+using node_augment_t =
+    std::conditional_t<std::is_same<Augment, no_augment>::value, void,
+                       NodeAugment<Node, Tag, Augment>>;
+
+// NodeType lets wrappers such as bounded_bimap keep extra per-pair links
+// inside the node, and selects the augmentation policies of the sides (see
+// augmented_bimap); it has to derive from the Node of the same keys and
+// comparators.
 template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
-          typename CompareRight = std::less<Right>>
+          typename CompareRight = std::less<Right>,
+          typename NodeType = Node<Left, Right, CompareLeft, CompareRight>>
 class bimap {
+  using left_augment_t = typename NodeType::left_augment;
+  using right_augment_t = typename NodeType::right_augment;
+
+  static_assert(std::is_base_of<Node<Left, Right, CompareLeft, CompareRight,
+                                     left_augment_t, right_augment_t>,
+                                NodeType>::value,
+                "NodeType must derive from Node<Left, Right, CompareLeft, "
+                "CompareRight, ...>");
 
   using left_t = Left;
   using right_t = Right;
-  using left_tree_t = IntrusiveCartesianTree<LeftTag, left_t, CompareLeft>;
-  using right_tree_t = IntrusiveCartesianTree<RightTag, right_t, CompareRight>;
+  using node_t = NodeType;
+  using left_tree_t =
+      IntrusiveCartesianTree<LeftTag, left_t, CompareLeft,
+                             NodeKeyOf<node_t, LeftTag>,
+                             node_augment_t<node_t, LeftTag, left_augment_t>>;
+  using right_tree_t =
+      IntrusiveCartesianTree<RightTag, right_t, CompareRight,
+                             NodeKeyOf<node_t, RightTag>,
+                             node_augment_t<node_t, RightTag, right_augment_t>>;
   using node_head_t = NodeHead;
 
+  // Storage of the nodes relocated by compact(). Maps made by split_left
+  // and join share the blocks of their sources, so a block is released by
+  // the last of its nodes to be freed rather than by a map.
+  struct node_block {
+    node_t* nodes;
+    size_t size;
+    std::atomic<size_t> live;
+
+    explicit node_block(size_t size)
+        : nodes(std::allocator<node_t>().allocate(size)), size(size),
+          live(0) {}
+
+    ~node_block() {
+      release();
+    }
+
+    bool holds(const node_t* node) const {
+      std::less<const node_t*> less;
+      return nodes != nullptr && !less(node, nodes) &&
+             less(node, nodes + size);
+    }
+
+    void release() {
+      if (nodes != nullptr) {
+        std::allocator<node_t>().deallocate(nodes, size);
+        nodes = nullptr;
+      }
+    }
+  };
+
   node_head_t head = NodeHead();
   left_tree_t left_set;
   right_tree_t right_set;
   size_t map_size = 0;
+  std::vector<std::shared_ptr<node_block>> blocks;
+  std::unique_ptr<key_filter<Left>> left_filter;
+  std::unique_ptr<key_filter<Right>> right_filter;
+
+  template <class Tag>
+  using key_of = std::conditional_t<std::is_same<Tag, LeftTag>::value, Left,
+                                    Right>;
+
+  std::unique_ptr<key_filter<Left>>& filter(LeftTag) {
+    return left_filter;
+  }
+
+  std::unique_ptr<key_filter<Right>>& filter(RightTag) {
+    return right_filter;
+  }
+
+  const std::unique_ptr<key_filter<Left>>& filter(LeftTag) const {
+    return left_filter;
+  }
+
+  const std::unique_ptr<key_filter<Right>>& filter(RightTag) const {
+    return right_filter;
+  }
+
+  // False if the filter of side Tag rules key out; without a filter every
+  // key may be present.
+  template <class Tag>
+  bool may_hold(key_of<Tag> const& key) const {
+    auto const& f = filter(Tag());
+    return f == nullptr || f->may_contain(key);
+  }
+
+  // Refills the filter of side Tag, if any, from the tree, sized for
+  // capacity keys.
+  template <class Tag>
+  void rebuild_filter(size_t capacity) {
+    auto& f = filter(Tag());
+    if (f == nullptr) {
+      return;
+    }
+    auto rebuilt = std::make_unique<key_filter<key_of<Tag>>>(f->hasher(),
+                                                             capacity);
+    tree(Tag()).for_each([&rebuilt](const IntrusiveNode<Tag>* hook) {
+      rebuilt->add(node_t::value_of(hook));
+    });
+    f = std::move(rebuilt);
+  }
+
+  void rebuild_filters() {
+    rebuild_filter<LeftTag>(map_size);
+    rebuild_filter<RightTag>(map_size);
+  }
+
+  // Empty filters with the hash functions of those of other.
+  void copy_filter_setup(bimap const& other) {
+    if (other.left_filter) {
+      left_filter = std::make_unique<key_filter<Left>>(
+          other.left_filter->hasher(), other.left_filter->capacity());
+    }
+    if (other.right_filter) {
+      right_filter = std::make_unique<key_filter<Right>>(
+          other.right_filter->hasher(), other.right_filter->capacity());
+    }
+  }
+
+  // The promote budgets of the trees of other; see enable_adaptive_lookups.
+  void copy_adaptive_setup(bimap const& other) {
+    left_set.set_promote_budget(other.left_set.get_promote_budget());
+    right_set.set_promote_budget(other.right_set.get_promote_budget());
+  }
+
+  // Called once node is linked; grows a filter that got too full.
+  template <class Tag>
+  void filter_add(node_t* node) {
+    auto& f = filter(Tag());
+    if (f != nullptr) {
+      f->add(node_t::value_of(static_cast<IntrusiveNode<Tag>*>(node)));
+      if (f->full()) {
+        rebuild_filter<Tag>(2 * f->capacity());
+      }
+    }
+  }
+
+  template <class Tag>
+  void filter_remove(node_t* node) {
+    auto& f = filter(Tag());
+    if (f != nullptr) {
+      f->remove(node_t::value_of(static_cast<IntrusiveNode<Tag>*>(node)));
+    }
+  }
+
+  void filter_add(node_t* node) {
+    filter_add<LeftTag>(node);
+    filter_add<RightTag>(node);
+  }
+
+  void free_node(node_t* node) {
+    for (size_t i = 0; i < blocks.size(); i++) {
+      if (blocks[i]->holds(node)) {
+        node->~node_t();
+        if (--blocks[i]->live == 0) {
+          blocks[i]->release();
+          blocks.erase(blocks.begin() + i);
+        }
+        return;
+      }
+    }
+    delete node;
+  }
+
+  void erase_node(node_t* node) {
+    filter_remove<LeftTag>(node);
+    filter_remove<RightTag>(node);
+    left_set.unlink(node);
+    right_set.unlink(node);
+    free_node(node);
+    map_size--;
+  }
+
+  void share_blocks(bimap const& other) {
+    for (auto const& block : other.blocks) {
+      if (std::find(blocks.begin(), blocks.end(), block) == blocks.end()) {
+        blocks.push_back(block);
+      }
+    }
+  }
+
+  // The copy of the node of hook made by relocate; hooks of head stay.
+  template <class Tag>
+  IntrusiveNode<Tag>* forward(IntrusiveNode<Tag>* hook) {
+    if (hook == nullptr || hook == static_cast<IntrusiveNode<Tag>*>(&head)) {
+      return hook;
+    }
+    return node_of(node_of(hook)->IntrusiveNode<LeftTag>::top);
+  }
+
+  template <class Tag>
+  void forward_links(IntrusiveNode<Tag>* hook) {
+    hook->left = forward(hook->left);
+    hook->right = forward(hook->right);
+    hook->top = forward(hook->top);
+    hook->succ = forward(hook->succ);
+    hook->pred = forward(hook->pred);
+  }
+
+  // Moves every node into one new block in pre-order of the tree of Tag:
+  // a descent in that tree then walks forward through memory and the top
+  // levels share cache lines. Links are copied as they are and then
+  // translated through a forwarding pointer left in each old node.
+  template <class Tag>
+  void relocate() {
+    if (empty()) {
+      return;
+    }
+    std::vector<node_t*> order;
+    order.reserve(map_size);
+    std::vector<const IntrusiveNode<Tag>*> stack = {
+        static_cast<IntrusiveNode<Tag>&>(head).left};
+    while (!stack.empty()) {
+      auto hook = stack.back();
+      stack.pop_back();
+      order.push_back(node_of(hook));
+      if (hook->right != nullptr) {
+        stack.push_back(hook->right);
+      }
+      if (hook->left != nullptr) {
+        stack.push_back(hook->left);
+      }
+    }
+
+    // Whole nodes are moved, keys, caches, aggregates and any state of
+    // NodeType included, if that cannot throw, and copied otherwise; then a
+    // throw leaves the old nodes as they were.
+    auto block = std::make_shared<node_block>(order.size());
+    for (; block->live < order.size(); block->live++) {
+      node_t* from = order[block->live];
+      try {
+        if constexpr (std::is_nothrow_move_constructible<node_t>::value) {
+          new (block->nodes + block->live) node_t(std::move(*from));
+        } else {
+          new (block->nodes + block->live)
+              node_t(static_cast<node_t const&>(*from));
+        }
+      } catch (...) {
+        for (size_t i = 0; i < block->live; i++) {
+          block->nodes[i].~node_t();
+        }
+        throw;
+      }
+    }
+    for (size_t i = 0; i < order.size(); i++) {
+      order[i]->IntrusiveNode<LeftTag>::top = block->nodes + i;
+    }
+    for (size_t i = 0; i < order.size(); i++) {
+      forward_links<LeftTag>(block->nodes + i);
+      forward_links<RightTag>(block->nodes + i);
+    }
+    forward_links<LeftTag>(&head);
+    forward_links<RightTag>(&head);
+    for (auto node : order) {
+      free_node(node);
+    }
+    blocks.push_back(std::move(block));
+  }
+
+  void swap_left_tree(bimap& other) {
+    std::swap(static_cast<IntrusiveNode<LeftTag>&>(head),
+              static_cast<IntrusiveNode<LeftTag>&>(other.head));
+    left_set.relink_head();
+    other.left_set.relink_head();
+  }
+
+  void swap_right_tree(bimap& other) {
+    std::swap(static_cast<IntrusiveNode<RightTag>&>(head),
+              static_cast<IntrusiveNode<RightTag>&>(other.head));
+    right_set.relink_head();
+    other.right_set.relink_head();
+  }
+
+  // Relinks the hooks of Tag of all nodes in from into to, one at a time.
+  template <class Tree>
+  static void move_all(Tree& from, Tree& to) {
+    auto cur = from.begin();
+    while (cur != from.end()) {
+      auto node = node_of(cur);
+      cur = cur->next();
+      from.unlink(node);
+      to.insert(node);
+    }
+  }
 
   void delete_all() {
-    size_t init_size = size();
-    for (size_t i = 0; i < init_size; i++) {
-      erase_left(*begin_left());
+    while (!empty()) {
+      pop_front_left();
+    }
+  }
+
+  left_tree_t& tree(LeftTag) {
+    return left_set;
+  }
+
+  right_tree_t& tree(RightTag) {
+    return right_set;
+  }
+
+  template <class LeftArg, class RightArg>
+  static node_t* make_node(LeftTag, LeftArg&& left, RightArg&& right) {
+    return new node_t(std::forward<LeftArg>(left),
+                      std::forward<RightArg>(right));
+  }
+
+  template <class RightArg, class LeftArg>
+  static node_t* make_node(RightTag, RightArg&& right, LeftArg&& left) {
+    return new node_t(std::forward<LeftArg>(left),
+                      std::forward<RightArg>(right));
+  }
+
+  // Gives node the key key on side Tag and relinks it right before
+  // position, the lower bound of key in that tree. The other tree is not
+  // touched and no comparisons are made.
+  template <class Tag, class Key>
+  void rekey(node_t* node, const IntrusiveNode<Tag>* position, Key&& key) {
+    IntrusiveNode<Tag>* hook = node;
+    if (position == hook) {
+      position = hook->succ;
+    }
+    filter_remove<Tag>(node);
+    try {
+      node->assign(Tag(), std::forward<Key>(key));
+    } catch (...) {
+      // The pair keeps its old key, so the filter has to count it again.
+      filter_add<Tag>(node);
+      throw;
+    }
+    tree(Tag()).unlink(node);
+    tree(Tag()).insert_before(position, node);
+    filter_add<Tag>(node);
+    refresh_aggregates(node);
+  }
+
+  // The aggregates of both sides depend on the whole pair of node, which
+  // changed in place.
+  void refresh_aggregates(node_t* node) {
+    left_set.refresh(node);
+    right_set.refresh(node);
+  }
+
+  template <class Tag, class Key>
+  bool replace(node_t* node, Key&& key) {
+    auto at = tree(Tag()).locate(key);
+    if (!at.second) {
+      rekey<Tag>(node, at.first, std::forward<Key>(key));
+      return true;
+    }
+    if (node_of(at.first) != node) {
+      return false;
+    }
+    node->assign(Tag(), std::forward<Key>(key));
+    refresh_aggregates(node);
+    return true;
+  }
+
+  // Throws unless each list is strictly ascending by left key, no left key
+  // is both removed and changed, every removed or changed left key is
+  // present, no added left key is, and the new right keys are distinct and
+  // held by no pair that stays unchanged.
+  void check_delta(bimap_delta<Left, Right> const& delta) const {
+    auto const& less_left = left_set.value_comp();
+    auto const& less_right = right_set.value_comp();
+    auto key_of = [](auto const& item) -> left_t const& {
+      if constexpr (std::is_same<std::decay_t<decltype(item)>,
+                                 left_t>::value) {
+        return item;
+      } else {
+        return item.first;
+      }
+    };
+    auto leaves = [&](left_t const& left) {
+      auto by_key = [&](auto const& item, left_t const& key) {
+        return less_left(key_of(item), key);
+      };
+      auto removed = std::lower_bound(delta.removed.begin(),
+                                      delta.removed.end(), left, by_key);
+      auto changed = std::lower_bound(delta.changed.begin(),
+                                      delta.changed.end(), left, by_key);
+      return (removed != delta.removed.end() && !less_left(left, *removed)) ||
+             (changed != delta.changed.end() &&
+              !less_left(left, changed->first));
+    };
+    auto fail = [] {
+      throw std::invalid_argument("delta does not match the bimap");
+    };
+    auto check_ascending = [&](auto const& list) {
+      for (size_t i = 1; i < list.size(); i++) {
+        if (!less_left(key_of(list[i - 1]), key_of(list[i]))) {
+          fail();
+        }
+      }
+    };
+    check_ascending(delta.removed);
+    check_ascending(delta.changed);
+    check_ascending(delta.added);
+    // Added keys must be absent and the others present, so only removed
+    // and changed can share a key.
+    for (auto const& pair : delta.changed) {
+      auto removed = std::lower_bound(delta.removed.begin(),
+                                      delta.removed.end(), pair.first,
+                                      less_left);
+      if (removed != delta.removed.end() && !less_left(pair.first, *removed)) {
+        fail();
+      }
+    }
+    auto hint = end_left();
+    for (auto const& left : delta.removed) {
+      hint = find_left(hint, left);
+      if (hint == end_left()) {
+        fail();
+      }
+    }
+    std::vector<const right_t*> rights;
+    hint = end_left();
+    for (auto const& pair : delta.changed) {
+      hint = find_left(hint, pair.first);
+      if (hint == end_left()) {
+        fail();
+      }
+      rights.push_back(&pair.second);
+    }
+    hint = end_left();
+    for (auto const& pair : delta.added) {
+      if (left_set.insert_position(hint.node_ptr, pair.first) == nullptr) {
+        fail();
+      }
+      hint = lower_bound_left(hint, pair.first);
+      rights.push_back(&pair.second);
+    }
+    for (auto right : rights) {
+      auto holder = find_right(*right);
+      if (holder != end_right() && !leaves(*holder.flip())) {
+        fail();
+      }
+    }
+    std::sort(rights.begin(), rights.end(),
+              [&](const right_t* a, const right_t* b) {
+                return less_right(*a, *b);
+              });
+    for (size_t i = 1; i < rights.size(); i++) {
+      if (!less_right(*rights[i - 1], *rights[i])) {
+        fail();
+      }
+    }
+  }
+
+  // Makes key, located on side Own as own_at, the partner of other_key.
+  // The pair of key, if any, gets other_key; otherwise the pair holding
+  // other_key, if any, gets key; otherwise a new pair is linked. A pair
+  // other than the one of key that holds other_key is erased. Returns the
+  // pair and whether key is new. Searches the Other tree once.
+  template <class Own, class Other, class KeyArg, class OtherArg>
+  std::pair<node_t*, bool>
+  upsert(std::pair<const IntrusiveNode<Own>*, bool> own_at, KeyArg&& key,
+         OtherArg&& other_key) {
+    auto other_at = tree(Other()).locate(other_key);
+    node_t* holder = other_at.second ? node_of(other_at.first) : nullptr;
+    if (own_at.second) {
+      node_t* node = node_of(own_at.first);
+      if (holder == node) {
+        return {node, false};
+      }
+      if (holder == nullptr) {
+        rekey<Other>(node, other_at.first, std::forward<OtherArg>(other_key));
+      } else {
+        rekey<Other>(node, other_at.first->succ,
+                     std::forward<OtherArg>(other_key));
+        erase_node(holder);
+      }
+      return {node, false};
+    }
+    if (holder != nullptr) {
+      rekey<Own>(holder, own_at.first, std::forward<KeyArg>(key));
+      return {holder, true};
     }
+    node_t* node = make_node(Own(), std::forward<KeyArg>(key),
+                             std::forward<OtherArg>(other_key));
+    tree(Own()).insert_before(own_at.first, node);
+    tree(Other()).insert_before(other_at.first, node);
+    map_size++;
+    filter_add(node);
+    return {node, true};
   }
 
+protected:
   template <class Tag, class Value, class Derived>
   class base_iterator {
   protected:
@@ -58,7 +638,7 @@ class bimap {
     using reference = Value const&;
 
     Value const& operator*() const {
-      return static_cast<const NodeBase<Value, Tag>*>(node_ptr)->value;
+      return node_t::value_of(node_ptr);
     }
 
     Value const* operator->() const {
@@ -106,8 +686,8 @@ class bimap {
 
   public:
     right_iterator flip() {
-      return right_iterator(
-          dynamic_cast<const IntrusiveNode<RightTag>*>(this->node_ptr));
+      return right_iterator(static_cast<const IntrusiveNode<RightTag>*>(
+          static_cast<const node_head_t*>(this->node_ptr)));
     }
   };
 
@@ -118,17 +698,41 @@ class bimap {
 
   public:
     left_iterator flip() {
-      return left_iterator(
-          dynamic_cast<const IntrusiveNode<LeftTag>*>(this->node_ptr));
+      return left_iterator(static_cast<const IntrusiveNode<LeftTag>*>(
+          static_cast<const node_head_t*>(this->node_ptr)));
     }
   };
 
+  template <class Tag>
+  static node_t* node_of(const IntrusiveNode<Tag>* node_ptr) {
+    return const_cast<node_t*>(
+        static_cast<const node_t*>(static_cast<const node_head_t*>(node_ptr)));
+  }
+
+  // The pair an iterator points to; it must not be an end iterator.
+  static node_t* node_of(left_iterator it) {
+    return node_of(it.node_ptr);
+  }
+
+  static node_t* node_of(right_iterator it) {
+    return node_of(it.node_ptr);
+  }
+
+  static left_iterator iterator_to(const node_t* node) {
+    return left_iterator(node);
+  }
+
 public:
   bimap(CompareLeft compare_left = CompareLeft(),
         CompareRight compare_right = CompareRight())
       : left_set(&head, compare_left), right_set(&head, compare_right) {}
 
-  bimap(bimap const& other) : bimap() {
+  // The copy gets the comparators of other, filters with the setup of
+  // those of other, and its adaptive lookups.
+  bimap(bimap const& other)
+      : bimap(other.left_set.value_comp(), other.right_set.value_comp()) {
+    copy_filter_setup(other);
+    copy_adaptive_setup(other);
     left_iterator other_left_iterator = other.begin_left();
     while (other_left_iterator != other.end_left()) {
       this->insert(*other_left_iterator, *other_left_iterator.flip());
@@ -140,11 +744,16 @@ public:
     this->swap(other);
   }
 
+  // As with the copy constructor, this map takes the filter setup and the
+  // adaptive lookups of other.
   bimap& operator=(bimap const& other) {
     if (this == &other) {
       return *this;
     }
     delete_all();
+    disable_filters();
+    copy_filter_setup(other);
+    copy_adaptive_setup(other);
     auto other_left_iterator = other.begin_left();
     while (other_left_iterator != other.end_left()) {
       this->insert(*other_left_iterator, *other_left_iterator.flip());
@@ -153,12 +762,25 @@ public:
     return *this;
   }
 
+  // Exchanges the pairs along with the comparators, filters and adaptive
+  // lookups.
   void swap(bimap& other) {
     std::swap(head, other.head);
+    std::swap(map_size, other.map_size);
+    blocks.swap(other.blocks);
+    left_filter.swap(other.left_filter);
+    right_filter.swap(other.right_filter);
+    size_t left_budget = left_set.get_promote_budget();
+    size_t right_budget = right_set.get_promote_budget();
     this->left_set = left_tree_t(&head);
     this->right_set = right_tree_t(&head);
     other.left_set = left_tree_t(&other.head);
     other.right_set = right_tree_t(&other.head);
+    left_set.swap_comparator(other.left_set);
+    right_set.swap_comparator(other.right_set);
+    copy_adaptive_setup(other);
+    other.left_set.set_promote_budget(left_budget);
+    other.right_set.set_promote_budget(right_budget);
   }
 
   bimap& operator=(bimap&& other) noexcept {
@@ -166,11 +788,7 @@ public:
       return *this;
     }
     this->delete_all();
-    std::swap(head, other.head);
-    this->left_set = left_tree_t(&head);
-    this->right_set = right_tree_t(&head);
-    other.left_set = left_tree_t(&other.head);
-    other.right_set = right_tree_t(&other.head);
+    swap(other);
     return *this;
   }
 
@@ -180,72 +798,382 @@ public:
 
   template <class LeftArg = left_t, class RightArg = right_t>
   left_iterator insert(LeftArg&& left, RightArg&& right) {
-    if (left_set.find(left) != nullptr || right_set.find(right) != nullptr) {
+    const left_t& left_key = left;
+    typename left_tree_t::key_probe key(left_key);
+    auto position = left_set.goes_last(key)
+                        ? std::make_pair(left_set.end(), false)
+                        : left_set.locate(key);
+    if (position.second ||
+        (may_hold<RightTag>(right) && right_set.find(right) != nullptr)) {
       return left_iterator(left_set.end());
     }
-    auto* node = new Node<left_t, right_t>(std::forward<LeftArg>(left),
-                                           std::forward<RightArg>(right));
-    left_set.insert(node);
+    auto* node = new node_t(std::forward<LeftArg>(left),
+                            std::forward<RightArg>(right));
+    left_set.insert_before(position.first, node);
+    right_set.insert(node);
+    map_size++;
+    filter_add(node);
+    return left_iterator{node};
+  }
+
+  // Hinted insert: the left side is searched and linked from hint, only the
+  // right side pays a full descent.
+  template <class LeftArg = left_t, class RightArg = right_t>
+  left_iterator insert(left_iterator hint, LeftArg&& left, RightArg&& right) {
+    auto position = left_set.insert_position(hint.node_ptr, left);
+    if (position == nullptr ||
+        (may_hold<RightTag>(right) && right_set.find(right) != nullptr)) {
+      return end_left();
+    }
+    auto* node = new node_t(std::forward<LeftArg>(left),
+                            std::forward<RightArg>(right));
+    left_set.insert_before(position, node);
     right_set.insert(node);
     map_size++;
+    filter_add(node);
     return left_iterator{node};
   }
 
   left_iterator erase_left(left_iterator it) {
-    erase_left(*(it++));
+    erase_node(node_of(it++));
     return it;
   }
 
   bool erase_left(left_t const& left) {
-    auto iterator_on_removed = find_left(left);
-    if (iterator_on_removed == end_left()) {
+    if (!may_hold<LeftTag>(left)) {
       return false;
     }
-    left_set.remove(*iterator_on_removed);
-    auto removed = right_set.remove(*iterator_on_removed.flip());
-    delete static_cast<Node<left_t, right_t>*>(removed);
-    map_size--;
+    auto found = left_set.find(left);
+    if (found == nullptr) {
+      return false;
+    }
+    erase_node(node_of(found));
     return true;
   }
 
   right_iterator erase_right(right_iterator it) {
-    auto curValue = *it;
-    it++;
-    erase_right(curValue);
+    erase_node(node_of(it++));
     return it;
   }
 
   bool erase_right(right_t const& right) {
-    auto found_right = find_right(right);
-    if (found_right == end_right()) {
+    if (!may_hold<RightTag>(right)) {
       return false;
-    } else {
-      erase_left(*found_right.flip());
-      return true;
     }
+    auto found = right_set.find(right);
+    if (found == nullptr) {
+      return false;
+    }
+    erase_node(node_of(found));
+    return true;
+  }
+
+  // Erases every pair for which pred(left, right) is true and returns how
+  // many there were; pred sees each pair once, in left order, before
+  // anything is changed. Matches are unlinked one by one, which needs no
+  // comparisons and O(1) expected work each; when more than three in four
+  // pairs go, rebuilding both trees from the few survivors in O(n) is
+  // cheaper.
+  template <class Predicate>
+  size_t erase_if(Predicate pred) {
+    std::vector<node_t*> doomed;
+    std::vector<IntrusiveNode<LeftTag>*> left_kept;
+    for (auto hook = left_set.begin(); hook != left_set.end();
+         hook = hook->next()) {
+      node_t* node = node_of(hook);
+      if (pred(std::as_const(node->left_value()),
+               std::as_const(node->right_value()))) {
+        doomed.push_back(node);
+      } else {
+        left_kept.push_back(node);
+      }
+    }
+    if (doomed.size() * 4 <= map_size * 3) {
+      for (auto node : doomed) {
+        erase_node(node);
+      }
+      return doomed.size();
+    }
+    // Real weights are never negative, so -1 marks the doomed nodes while
+    // the right order is collected.
+    for (auto node : doomed) {
+      static_cast<IntrusiveNode<RightTag>*>(node)->weight = -1;
+    }
+    std::vector<IntrusiveNode<RightTag>*> right_kept;
+    right_kept.reserve(left_kept.size());
+    for (auto hook = right_set.begin(); hook != right_set.end();
+         hook = hook->next()) {
+      if (hook->weight != -1) {
+        right_kept.push_back(const_cast<IntrusiveNode<RightTag>*>(hook));
+      }
+    }
+    left_set.assign_sorted(left_kept.begin(), left_kept.end());
+    right_set.assign_sorted(right_kept.begin(), right_kept.end());
+    for (auto node : doomed) {
+      filter_remove<LeftTag>(node);
+      filter_remove<RightTag>(node);
+      free_node(node);
+    }
+    map_size -= doomed.size();
+    return doomed.size();
   }
 
   left_iterator erase_left(left_iterator first, left_iterator last) {
     while (first != last) {
-      left_iterator cur = first;
-      first++;
-      erase_left(*cur);
+      first = erase_left(first);
     }
     return last;
   }
 
   right_iterator erase_right(right_iterator first, right_iterator last) {
-    while (true) {
-      if (first == last) {
-        return last;
+    while (first != last) {
+      first = erase_right(first);
+    }
+    return last;
+  }
+
+  // Moves all pairs with left >= key to the returned bimap without copying
+  // them. The left tree is split in O(log n); on the right side only the
+  // smaller part is relinked, node by node.
+  bimap split_left(left_t const& key) {
+    bimap result(left_set.value_comp(), right_set.value_comp());
+    result.share_blocks(*this);
+    left_set.split_to(key, result.left_set);
+    auto kept = left_set.begin();
+    auto taken = result.left_set.begin();
+    size_t steps = 0;
+    while (kept != left_set.end() && taken != result.left_set.end()) {
+      kept = kept->next();
+      taken = taken->next();
+      steps++;
+    }
+    if (taken == result.left_set.end()) {
+      result.map_size = steps;
+      for (auto cur = result.left_set.begin(); cur != result.left_set.end();
+           cur = cur->next()) {
+        right_set.unlink(node_of(cur));
+        result.right_set.insert(node_of(cur));
+      }
+    } else {
+      result.map_size = map_size - steps;
+      swap_right_tree(result);
+      for (auto cur = left_set.begin(); cur != left_set.end();
+           cur = cur->next()) {
+        result.right_set.unlink(node_of(cur));
+        right_set.insert(node_of(cur));
+      }
+    }
+    map_size -= result.map_size;
+    result.copy_filter_setup(*this);
+    result.copy_adaptive_setup(*this);
+    rebuild_filters();
+    result.rebuild_filters();
+    return result;
+  }
+
+  // Moves all pairs of other into this bimap without copying them. No left
+  // and no right key may be present in both; otherwise nothing is changed
+  // and std::invalid_argument is thrown. If all left keys of one map precede
+  // those of the other, the left trees are joined in O(log n); the right
+  // side relinks the nodes of the smaller map one by one.
+  void join(bimap&& other) {
+    if (other.empty()) {
+      return;
+    }
+    if (empty()) {
+      // Only the trees change hands: the filters and lookups of both maps
+      // stay as they were set up.
+      share_blocks(other);
+      swap_left_tree(other);
+      swap_right_tree(other);
+      std::swap(map_size, other.map_size);
+      rebuild_filters();
+      other.rebuild_filters();
+      return;
+    }
+    bool other_after = left_set.goes_last(*other.begin_left());
+    bool other_before = other.left_set.goes_last(*begin_left());
+    bimap& smaller = size() < other.size() ? *this : other;
+    bimap& larger = size() < other.size() ? other : *this;
+    for (auto it = smaller.begin_left(); it != smaller.end_left(); ++it) {
+      if (larger.right_set.find(*it.flip()) != nullptr ||
+          (!other_after && !other_before &&
+           larger.left_set.find(*it) != nullptr)) {
+        throw std::invalid_argument("join of bimaps with common keys");
+      }
+    }
+
+    share_blocks(other);
+    if (other_after) {
+      left_set.join(other.left_set);
+    } else if (other_before) {
+      other.left_set.join(left_set);
+      swap_left_tree(other);
+    } else {
+      move_all(other.left_set, left_set);
+    }
+    if (size() < other.size()) {
+      swap_right_tree(other);
+    }
+    move_all(other.right_set, right_set);
+    map_size += other.map_size;
+    other.map_size = 0;
+    rebuild_filters();
+    other.rebuild_filters();
+  }
+
+  using delta_type = bimap_delta<Left, Right>;
+
+  // The changes that turn a into b, found in one merge walk over the left
+  // orders of both maps.
+  static delta_type diff(bimap const& a, bimap const& b) {
+    auto const& less_left = a.left_set.value_comp();
+    auto const& less_right = a.right_set.value_comp();
+    delta_type delta;
+    auto ita = a.begin_left();
+    auto itb = b.begin_left();
+    while (ita != a.end_left() || itb != b.end_left()) {
+      if (itb == b.end_left() ||
+          (ita != a.end_left() && less_left(*ita, *itb))) {
+        delta.removed.push_back(*ita++);
+      } else if (ita == a.end_left() || less_left(*itb, *ita)) {
+        delta.added.emplace_back(*itb, *itb.flip());
+        ++itb;
+      } else {
+        auto const& right_a = *ita.flip();
+        auto const& right_b = *itb.flip();
+        if (less_right(right_a, right_b) || less_right(right_b, right_a)) {
+          delta.changed.emplace_back(*itb, right_b);
+        }
+        ++ita;
+        ++itb;
       }
-      right_iterator cur = first;
-      first++;
-      erase_right(*cur);
     }
+    return delta;
+  }
+
+  // Applies a delta made by diff against a map equal to this one. Each
+  // list is walked in left order with finger searches from the previous
+  // position, so a batch of k changes costs O(k log(n / k)) on the left
+  // side. Changed pairs are unlinked from the right tree together before
+  // their new keys are linked, so pairs may exchange right keys. A delta
+  // that does not fit this map throws std::invalid_argument before anything
+  // is changed.
+  void apply_delta(delta_type const& delta) {
+    check_delta(delta);
+    auto hint = end_left();
+    for (auto const& left : delta.removed) {
+      hint = erase_left(find_left(hint, left));
+    }
+    std::vector<node_t*> changed;
+    changed.reserve(delta.changed.size());
+    hint = end_left();
+    for (auto const& pair : delta.changed) {
+      hint = find_left(hint, pair.first);
+      changed.push_back(node_of(hint));
+      right_set.unlink(changed.back());
+    }
+    for (size_t i = 0; i < changed.size(); i++) {
+      filter_remove<RightTag>(changed[i]);
+      changed[i]->assign(RightTag(), delta.changed[i].second);
+      right_set.insert(changed[i]);
+      filter_add<RightTag>(changed[i]);
+      left_set.refresh(changed[i]);
+    }
+    hint = end_left();
+    for (auto const& pair : delta.added) {
+      hint = insert(hint, pair.first, pair.second);
+    }
+  }
+
+  // Puts an approximate-membership filter in front of the left side: a
+  // blocked counting Bloom filter kept in sync by every update, so that
+  // find, at, erase by key and the duplicate check of insert skip the tree
+  // for most absent keys at the cost of one cache line. It is sized for
+  // expected_size keys (at least the current size) and grows with the
+  // map; split_left and join rebuild it in O(n).
+  template <class Hash = std::hash<Left>>
+  void enable_left_filter(size_t expected_size = 0) {
+    left_filter = std::make_unique<key_filter<Left>>(
+        [](const Left& key) -> std::size_t { return Hash()(key); },
+        std::max(expected_size, map_size));
+    rebuild_filter<LeftTag>(left_filter->capacity());
+  }
+
+  template <class Hash = std::hash<Right>>
+  void enable_right_filter(size_t expected_size = 0) {
+    right_filter = std::make_unique<key_filter<Right>>(
+        [](const Right& key) -> std::size_t { return Hash()(key); },
+        std::max(expected_size, map_size));
+    rebuild_filter<RightTag>(right_filter->capacity());
+  }
+
+  void disable_filters() {
+    left_filter.reset();
+    right_filter.reset();
+  }
+
+  // Self-adjusting lookups for skewed key popularity: each hit of
+  // find_left / find_right (and so at_*) raises the priority of the found
+  // node and rotates it up by at most budget levels, so hot keys end up a
+  // few nodes below the root. Lookups then modify the trees: a bimap in
+  // this mode must not be read concurrently, which is why it is opt-in.
+  void enable_adaptive_lookups(size_t budget = 4) {
+    left_set.set_promote_budget(budget);
+    right_set.set_promote_budget(budget);
+  }
+
+  void disable_adaptive_lookups() {
+    enable_adaptive_lookups(0);
+  }
+
+  // Combination under the left augmentation policy of the pairs with
+  // lo <= left < hi, in left order; O(log n) whatever the size of the range.
+  template <class Augment = left_augment_t>
+  typename Augment::value_type aggregate_left(left_t const& lo,
+                                              left_t const& hi) const {
+    return left_set.aggregate(lo, hi);
+  }
+
+  template <class Augment = right_augment_t>
+  typename Augment::value_type aggregate_right(right_t const& lo,
+                                               right_t const& hi) const {
+    return right_set.aggregate(lo, hi);
+  }
+
+  // Zeroes if the side has no filter.
+  filter_stats left_filter_stats() const {
+    return left_filter ? left_filter->stats() : filter_stats();
+  }
+
+  filter_stats right_filter_stats() const {
+    return right_filter ? right_filter->stats() : filter_stats();
+  }
+
+  // Relocates all nodes into one contiguous block laid out in pre-order of
+  // the left tree (compact) or of the right tree (compact_right), so that
+  // searches on that side touch neighbouring memory. Contents and order
+  // are unchanged, but iterators are invalidated. The old nodes are freed
+  // afterwards; a previous block is released once its last node is gone.
+  void compact() {
+    relocate<LeftTag>();
+  }
+
+  void compact_right() {
+    relocate<RightTag>();
+  }
+
+  // Removes the pair with the smallest left key, which must exist. Together
+  // with the append path of insert this makes a sliding window over
+  // increasing keys O(1) expected on the left side.
+  void pop_front_left() {
+    erase_node(node_of(left_set.begin()));
   }
 
   left_iterator find_left(left_t const& left) const {
+    if (!may_hold<LeftTag>(left)) {
+      return end_left();
+    }
     auto found = left_set.find(left);
     if (found == nullptr) {
       return end_left();
@@ -255,6 +1183,9 @@ public:
   }
 
   right_iterator find_right(right_t const& right) const {
+    if (!may_hold<RightTag>(right)) {
+      return end_right();
+    }
     auto found = right_set.find(right);
     if (found == nullptr) {
       return end_right();
@@ -263,6 +1194,50 @@ public:
     }
   }
 
+  // Batched variants of find_left/find_right: write one iterator per key of
+  // [first, last) to out, end iterator for absent keys.
+  template <class LeftIt, class OutputIt>
+  OutputIt find_left_batch(LeftIt first, LeftIt last, OutputIt out) const {
+    left_set.find_batch(first, last, [&](const IntrusiveNode<LeftTag>* found) {
+      *out++ = found == nullptr ? end_left() : left_iterator(found);
+    });
+    return out;
+  }
+
+  template <class RightIt, class OutputIt>
+  OutputIt find_right_batch(RightIt first, RightIt last, OutputIt out) const {
+    right_set.find_batch(
+        first, last, [&](const IntrusiveNode<RightTag>* found) {
+          *out++ = found == nullptr ? end_right() : right_iterator(found);
+        });
+    return out;
+  }
+
+  // Batched variants of at_left/at_right: write the paired value of every
+  // key to out, throw std::out_of_range on the first absent key.
+  template <class LeftIt, class OutputIt>
+  OutputIt at_left_batch(LeftIt first, LeftIt last, OutputIt out) const {
+    left_set.find_batch(first, last, [&](const IntrusiveNode<LeftTag>* found) {
+      if (found == nullptr) {
+        throw std::out_of_range("at_left_batch fail");
+      }
+      *out++ = *left_iterator(found).flip();
+    });
+    return out;
+  }
+
+  template <class RightIt, class OutputIt>
+  OutputIt at_right_batch(RightIt first, RightIt last, OutputIt out) const {
+    right_set.find_batch(
+        first, last, [&](const IntrusiveNode<RightTag>* found) {
+          if (found == nullptr) {
+            throw std::out_of_range("at_right_batch fail");
+          }
+          *out++ = *right_iterator(found).flip();
+        });
+    return out;
+  }
+
   right_t const& at_left(left_t const& key) const {
     auto found_iterator = find_left(key);
     if (found_iterator == end_left()) {
@@ -279,76 +1254,147 @@ public:
     return *found_iterator.flip();
   }
 
+  // The right key of left, or a default-constructed one paired with left
+  // if left is absent; a pair already holding that default is replaced.
   template <class Q = right_t>
   typename std::enable_if<std::is_default_constructible<Q>::value,
                           right_t>::type const&
   at_left_or_default(left_t const& key) {
-    auto found_left = find_left(key);
-    if (found_left == end_left()) {
-      auto default_right = right_t();
-      auto found_default_right = find_right(default_right);
-      if (found_default_right != end_right()) {
-        erase_right(default_right);
-      }
-      return *insert(key, std::move(default_right)).flip();
-    } else {
-      return *found_left.flip();
+    auto located = left_set.locate(key);
+    if (located.second) {
+      return node_of(located.first)->right_value();
     }
+    return upsert<LeftTag, RightTag>(located, key, right_t())
+        .first->right_value();
   }
 
   template <class Q = left_t>
   typename std::enable_if<std::is_default_constructible<Q>::value,
                           left_t>::type const&
   at_right_or_default(right_t const& key) {
-    auto found_right = find_right(key);
-    if (found_right == end_right()) {
-      auto default_left = left_t();
-      auto found_default_left = find_left(default_left);
-      if (found_default_left != end_left()) {
-        erase_left(default_left);
-      }
-      return *insert(std::move(default_left), key);
-    } else {
-      return *found_right.flip();
+    auto located = right_set.locate(key);
+    if (located.second) {
+      return node_of(located.first)->left_value();
     }
+    return upsert<RightTag, LeftTag>(located, key, left_t())
+        .first->left_value();
+  }
+
+  // Makes left map to right with one descent per tree. If left is present,
+  // its pair takes right as the new right key; otherwise a pair holding
+  // right takes left as its left key, or a new pair is inserted. Any other
+  // pair holding right is erased. The bool is true if left was not present.
+  template <class LeftArg = left_t, class RightArg = right_t>
+  std::pair<left_iterator, bool> insert_or_assign_left(LeftArg&& left,
+                                                       RightArg&& right) {
+    auto result = upsert<LeftTag, RightTag>(left_set.locate(left),
+                                            std::forward<LeftArg>(left),
+                                            std::forward<RightArg>(right));
+    return {left_iterator(result.first), result.second};
+  }
+
+  // The same with the roles of the sides swapped.
+  template <class RightArg = right_t, class LeftArg = left_t>
+  std::pair<right_iterator, bool> insert_or_assign_right(RightArg&& right,
+                                                         LeftArg&& left) {
+    auto result = upsert<RightTag, LeftTag>(right_set.locate(right),
+                                            std::forward<RightArg>(right),
+                                            std::forward<LeftArg>(left));
+    return {right_iterator(result.first), result.second};
+  }
+
+  // Changes the right key of the pair of it in place: the node is only
+  // relinked in the right tree. Returns false and changes nothing if another
+  // pair already holds right.
+  template <class RightArg = right_t>
+  bool replace_right(left_iterator it, RightArg&& right) {
+    return replace<RightTag>(node_of(it), std::forward<RightArg>(right));
+  }
+
+  template <class LeftArg = left_t>
+  bool replace_left(right_iterator it, LeftArg&& left) {
+    return replace<LeftTag>(node_of(it), std::forward<LeftArg>(left));
   }
 
   left_iterator lower_bound_left(const left_t& left) const {
-    auto lower = left_set.lower_bound(left);
-    if (lower == nullptr) {
-      return end_left();
-    }
-    return left_iterator(lower);
+    return left_iterator(left_set.lower_bound(left));
   }
 
   left_iterator upper_bound_left(const left_t& left) const {
-    auto lower = lower_bound_left(left);
-    if (lower == end_left()) {
-      return end_left();
-    }
-    if (*lower == left) {
-      lower++;
-    }
-    return lower;
+    return left_iterator(left_set.upper_bound(left));
   }
 
   right_iterator lower_bound_right(const right_t& right) const {
-    auto lower = right_set.lower_bound(right);
-    if (lower == nullptr) {
-      return end_right();
-    }
-    return right_iterator(lower);
+    return right_iterator(right_set.lower_bound(right));
   }
 
   right_iterator upper_bound_right(const right_t& right) const {
-    auto lower = lower_bound_right(right);
-    if (lower == end_right()) {
-      return end_right();
+    return right_iterator(right_set.upper_bound(right));
+  }
+
+  // Hinted lookups: same results as the plain ones, but the search starts
+  // at hint and costs O(log d) for a key d positions away from it.
+  left_iterator find_left(left_iterator hint, left_t const& left) const {
+    if (!may_hold<LeftTag>(left)) {
+      return end_left();
     }
-    if (*lower == right) {
-      lower++;
+    auto found = left_set.find(hint.node_ptr, left);
+    return found == nullptr ? end_left() : left_iterator(found);
+  }
+
+  right_iterator find_right(right_iterator hint, right_t const& right) const {
+    if (!may_hold<RightTag>(right)) {
+      return end_right();
     }
-    return lower;
+    auto found = right_set.find(hint.node_ptr, right);
+    return found == nullptr ? end_right() : right_iterator(found);
+  }
+
+  left_iterator lower_bound_left(left_iterator hint,
+                                 const left_t& left) const {
+    return left_iterator(left_set.lower_bound(hint.node_ptr, left));
+  }
+
+  right_iterator lower_bound_right(right_iterator hint,
+                                   const right_t& right) const {
+    return right_iterator(right_set.lower_bound(hint.node_ptr, right));
+  }
+
+  // Visit pairs without iterators: visit(left, right) is called for every
+  // pair with lo <= key < hi on the given side (or for all of them) in that
+  // side's order. The visitor must not modify the bimap.
+  template <class Visitor>
+  void for_each_left(left_t const& lo, left_t const& hi,
+                     Visitor&& visit) const {
+    left_set.for_each(lo, hi, [&](const IntrusiveNode<LeftTag>* node_ptr) {
+      auto* node = node_of(node_ptr);
+      visit(node->left_value(), node->right_value());
+    });
+  }
+
+  template <class Visitor>
+  void for_each_left(Visitor&& visit) const {
+    left_set.for_each([&](const IntrusiveNode<LeftTag>* node_ptr) {
+      auto* node = node_of(node_ptr);
+      visit(node->left_value(), node->right_value());
+    });
+  }
+
+  template <class Visitor>
+  void for_each_right(right_t const& lo, right_t const& hi,
+                      Visitor&& visit) const {
+    right_set.for_each(lo, hi, [&](const IntrusiveNode<RightTag>* node_ptr) {
+      auto* node = node_of(node_ptr);
+      visit(node->left_value(), node->right_value());
+    });
+  }
+
+  template <class Visitor>
+  void for_each_right(Visitor&& visit) const {
+    right_set.for_each([&](const IntrusiveNode<RightTag>* node_ptr) {
+      auto* node = node_of(node_ptr);
+      visit(node->left_value(), node->right_value());
+    });
   }
 
   left_iterator begin_left() const {
@@ -398,3 +1444,21 @@ public:
     return !(a == b);
   }
 };
+
+// bimap whose sides keep range aggregates under the given augmentation
+// policies (see NodeAggregate), queried by aggregate_left / aggregate_right.
+template <typename Left, typename Right, typename AugmentLeft,
+          typename AugmentRight = no_augment,
+          typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>>
+using augmented_bimap =
+    bimap<Left, Right, CompareLeft, CompareRight,
+          Node<Left, Right, CompareLeft, CompareRight, AugmentLeft,
+               AugmentRight>>;
+
+template <typename Left, typename Right, typename CompareLeft,
+          typename CompareRight, typename NodeType, typename Predicate>
+size_t erase_if(bimap<Left, Right, CompareLeft, CompareRight, NodeType>& map,
+                Predicate pred) {
+  return map.erase_if(pred);
+}
@@ -0,0 +1,152 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Changes that turn one bimap into another, as made by bimap::diff and
+// consumed by bimap::apply_delta. Every list is sorted by left key in the
+// order of the maps: removed holds left keys whose pairs go away, changed
+// pairs whose left key stays but gets a new right key, added new pairs.
+template <typename Left, typename Right>
+struct bimap_delta {
+  std::vector<Left> removed;
+  std::vector<std::pair<Left, Right>> changed;
+  std::vector<std::pair<Left, Right>> added;
+
+  bool empty() const {
+    return removed.empty() && changed.empty() && added.empty();
+  }
+
+  std::size_t size() const {
+    return removed.size() + changed.size() + added.size();
+  }
+};
+
+namespace bimap_delta_encoding {
+
+inline void put_varint(std::vector<unsigned char>& out, std::uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<unsigned char>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<unsigned char>(value));
+}
+
+inline std::uint64_t get_varint(const unsigned char*& in,
+                                const unsigned char* end) {
+  std::uint64_t value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (in == end) {
+      throw std::invalid_argument("truncated bimap_delta");
+    }
+    unsigned char byte = *in++;
+    value |= std::uint64_t(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+  }
+  throw std::invalid_argument("malformed bimap_delta");
+}
+
+// Integers are written as zigzag varints of their difference to prev, so
+// sorted keys and small values take one or two bytes; other trivially
+// copyable types are written as their bytes.
+template <class T>
+void put(std::vector<unsigned char>& out, T const& value, T const& prev) {
+  if constexpr (std::is_integral<T>::value) {
+    auto diff = static_cast<std::int64_t>(static_cast<std::uint64_t>(value) -
+                                          static_cast<std::uint64_t>(prev));
+    put_varint(out, (static_cast<std::uint64_t>(diff) << 1) ^
+                        static_cast<std::uint64_t>(diff >> 63));
+  } else {
+    auto bytes = reinterpret_cast<const unsigned char*>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+  }
+}
+
+template <class T>
+T get(const unsigned char*& in, const unsigned char* end, T const& prev) {
+  if constexpr (std::is_integral<T>::value) {
+    std::uint64_t zigzag = get_varint(in, end);
+    std::uint64_t diff = (zigzag >> 1) ^ (~(zigzag & 1) + 1);
+    return static_cast<T>(static_cast<std::uint64_t>(prev) + diff);
+  } else {
+    if (std::size_t(end - in) < sizeof(T)) {
+      throw std::invalid_argument("truncated bimap_delta");
+    }
+    T value;
+    std::memcpy(&value, in, sizeof(T));
+    in += sizeof(T);
+    return value;
+  }
+}
+
+} // namespace bimap_delta_encoding
+
+// Binary form of a delta for trivially copyable keys: three counts, then
+// the lists; left keys are delta-coded against the previous left key.
+template <typename Left, typename Right>
+std::vector<unsigned char> encode(bimap_delta<Left, Right> const& delta) {
+  static_assert(std::is_trivially_copyable<Left>::value &&
+                    std::is_trivially_copyable<Right>::value,
+                "encode needs trivially copyable keys");
+  using namespace bimap_delta_encoding;
+  std::vector<unsigned char> out;
+  put_varint(out, delta.removed.size());
+  put_varint(out, delta.changed.size());
+  put_varint(out, delta.added.size());
+  Left prev{};
+  for (auto const& left : delta.removed) {
+    put(out, left, prev);
+    prev = left;
+  }
+  for (auto const* pairs : {&delta.changed, &delta.added}) {
+    prev = Left{};
+    for (auto const& pair : *pairs) {
+      put(out, pair.first, prev);
+      put(out, pair.second, Right{});
+      prev = pair.first;
+    }
+  }
+  return out;
+}
+
+// Inverse of encode; throws std::invalid_argument on malformed input.
+template <typename Left, typename Right>
+bimap_delta<Left, Right> decode(std::vector<unsigned char> const& bytes) {
+  static_assert(std::is_trivially_copyable<Left>::value &&
+                    std::is_trivially_copyable<Right>::value,
+                "decode needs trivially copyable keys");
+  using namespace bimap_delta_encoding;
+  const unsigned char* in = bytes.data();
+  const unsigned char* end = in + bytes.size();
+  std::uint64_t counts[3];
+  for (auto& count : counts) {
+    count = get_varint(in, end);
+    if (count > bytes.size()) {
+      throw std::invalid_argument("malformed bimap_delta");
+    }
+  }
+  bimap_delta<Left, Right> delta;
+  Left prev{};
+  for (std::uint64_t i = 0; i < counts[0]; i++) {
+    prev = get(in, end, prev);
+    delta.removed.push_back(prev);
+  }
+  for (int list = 0; list < 2; list++) {
+    prev = Left{};
+    for (std::uint64_t i = 0; i < counts[list + 1]; i++) {
+      prev = get(in, end, prev);
+      Right right = get(in, end, Right{});
+      (list == 0 ? delta.changed : delta.added).emplace_back(prev, right);
+    }
+  }
+  if (in != end) {
+    throw std::invalid_argument("malformed bimap_delta");
+  }
+  return delta;
+}
@@ -0,0 +1,300 @@
+#pragma once
+#include "bimap.h"
+#include <cstddef>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+enum class eviction_policy { lru, fifo };
+
+// Recency ring of bounded_bimap. The sentinel closes it: sentinel.newer is
+// the oldest pair and sentinel.older the newest one.
+struct RecencyHook {
+  RecencyHook* newer = nullptr;
+  RecencyHook* older = nullptr;
+};
+
+template <class Left, class Right, class CompareLeft, class CompareRight>
+struct RecencyNode : public Node<Left, Right, CompareLeft, CompareRight>,
+                     public RecencyHook {
+  using Node<Left, Right, CompareLeft, CompareRight>::Node;
+};
+
+// bimap holding at most capacity() pairs. Inserting into a full map evicts
+// the oldest pair: the least recently inserted or accessed one under
+// eviction_policy::lru, the least recently inserted one under
+// eviction_policy::fifo. Lookups through a non-const object count as
+// accesses; lookups through a const one and bound queries do not.
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>>
+class bounded_bimap
+    : private bimap<Left, Right, CompareLeft, CompareRight,
+                    RecencyNode<Left, Right, CompareLeft, CompareRight>> {
+
+  using base = bimap<Left, Right, CompareLeft, CompareRight,
+                     RecencyNode<Left, Right, CompareLeft, CompareRight>>;
+  using left_t = Left;
+  using right_t = Right;
+  using node_t = RecencyNode<Left, Right, CompareLeft, CompareRight>;
+  using left_iterator = typename base::left_iterator;
+  using right_iterator = typename base::right_iterator;
+  using eviction_callback = std::function<void(Left const&, Right const&)>;
+
+  RecencyHook recency;
+  size_t max_size;
+  eviction_policy policy;
+  eviction_callback on_evict;
+
+  void unlink_recency(RecencyHook* hook) {
+    hook->older->newer = hook->newer;
+    hook->newer->older = hook->older;
+  }
+
+  void link_newest(RecencyHook* hook) {
+    hook->older = recency.older;
+    hook->newer = &recency;
+    recency.older->newer = hook;
+    recency.older = hook;
+  }
+
+  void touch(RecencyHook* hook) {
+    if (policy == eviction_policy::lru) {
+      unlink_recency(hook);
+      link_newest(hook);
+    }
+  }
+
+  void reset_recency() {
+    if (base::empty()) {
+      recency.newer = recency.older = &recency;
+    } else {
+      recency.newer->older = &recency;
+      recency.older->newer = &recency;
+    }
+  }
+
+  void erase_oldest() {
+    auto* oldest = static_cast<node_t*>(recency.newer);
+    unlink_recency(oldest);
+    base::erase_left(base::iterator_to(oldest));
+  }
+
+  // Copies the pairs to evict, erases them and only then reports them, so
+  // a callback that throws finds the map consistent and within limit; the
+  // pairs after the one whose callback threw are not reported.
+  void shrink_to(size_t limit) {
+    if (base::size() <= limit) {
+      return;
+    }
+    std::vector<std::pair<Left, Right>> evicted;
+    if (on_evict) {
+      evicted.reserve(base::size() - limit);
+      for (auto* hook = recency.newer; evicted.size() < base::size() - limit;
+           hook = hook->newer) {
+        auto* node = static_cast<node_t*>(hook);
+        evicted.emplace_back(node->left_value(), node->right_value());
+      }
+    }
+    while (base::size() > limit) {
+      erase_oldest();
+    }
+    for (auto const& pair : evicted) {
+      on_evict(pair.first, pair.second);
+    }
+  }
+
+  void copy_from(bounded_bimap const& other) {
+    for (auto* hook = other.recency.newer; hook != &other.recency;
+         hook = hook->newer) {
+      auto* node = static_cast<node_t*>(hook);
+      insert(node->left_value(), node->right_value());
+    }
+  }
+
+public:
+  explicit bounded_bimap(size_t capacity,
+                         eviction_policy policy = eviction_policy::lru,
+                         CompareLeft compare_left = CompareLeft(),
+                         CompareRight compare_right = CompareRight())
+      : base(compare_left, compare_right), max_size(capacity),
+        policy(policy) {
+    if (capacity == 0) {
+      throw std::invalid_argument("bounded_bimap capacity must be positive");
+    }
+    reset_recency();
+  }
+
+  bounded_bimap(bounded_bimap const& other)
+      : bounded_bimap(other.max_size, other.policy) {
+    on_evict = other.on_evict;
+    copy_from(other);
+  }
+
+  bounded_bimap(bounded_bimap&& other) noexcept
+      : bounded_bimap(other.max_size, other.policy) {
+    swap(other);
+  }
+
+  bounded_bimap& operator=(bounded_bimap const& other) {
+    if (this != &other) {
+      bounded_bimap(other).swap(*this);
+    }
+    return *this;
+  }
+
+  bounded_bimap& operator=(bounded_bimap&& other) noexcept {
+    if (this != &other) {
+      swap(other);
+    }
+    return *this;
+  }
+
+  void swap(bounded_bimap& other) {
+    base::swap(other);
+    std::swap(recency, other.recency);
+    std::swap(max_size, other.max_size);
+    std::swap(policy, other.policy);
+    std::swap(on_evict, other.on_evict);
+    reset_recency();
+    other.reset_recency();
+  }
+
+  // Called with copies of both sides of every evicted pair right after it
+  // is erased. Explicit erasures are not reported.
+  void set_eviction_callback(eviction_callback callback) {
+    on_evict = std::move(callback);
+  }
+
+  size_t capacity() const {
+    return max_size;
+  }
+
+  void set_capacity(size_t capacity) {
+    if (capacity == 0) {
+      throw std::invalid_argument("bounded_bimap capacity must be positive");
+    }
+    max_size = capacity;
+    shrink_to(max_size);
+  }
+
+  eviction_policy get_eviction_policy() const {
+    return policy;
+  }
+
+  template <class LeftArg = left_t, class RightArg = right_t>
+  left_iterator insert(LeftArg&& left, RightArg&& right) {
+    auto it = base::insert(std::forward<LeftArg>(left),
+                           std::forward<RightArg>(right));
+    if (it != end_left()) {
+      link_newest(base::node_of(it));
+      shrink_to(max_size);
+    }
+    return it;
+  }
+
+  left_iterator erase_left(left_iterator it) {
+    unlink_recency(base::node_of(it));
+    return base::erase_left(it);
+  }
+
+  bool erase_left(left_t const& left) {
+    auto it = base::find_left(left);
+    if (it == end_left()) {
+      return false;
+    }
+    erase_left(it);
+    return true;
+  }
+
+  right_iterator erase_right(right_iterator it) {
+    unlink_recency(base::node_of(it));
+    return base::erase_right(it);
+  }
+
+  bool erase_right(right_t const& right) {
+    auto it = base::find_right(right);
+    if (it == end_right()) {
+      return false;
+    }
+    erase_right(it);
+    return true;
+  }
+
+  left_iterator erase_left(left_iterator first, left_iterator last) {
+    while (first != last) {
+      first = erase_left(first);
+    }
+    return last;
+  }
+
+  right_iterator erase_right(right_iterator first, right_iterator last) {
+    while (first != last) {
+      first = erase_right(first);
+    }
+    return last;
+  }
+
+  left_iterator find_left(left_t const& left) {
+    auto it = base::find_left(left);
+    if (it != end_left()) {
+      touch(base::node_of(it));
+    }
+    return it;
+  }
+
+  right_iterator find_right(right_t const& right) {
+    auto it = base::find_right(right);
+    if (it != end_right()) {
+      touch(base::node_of(it));
+    }
+    return it;
+  }
+
+  right_t const& at_left(left_t const& key) {
+    auto it = find_left(key);
+    if (it == end_left()) {
+      throw std::out_of_range("at_left fail");
+    }
+    return *it.flip();
+  }
+
+  left_t const& at_right(right_t const& key) {
+    auto it = find_right(key);
+    if (it == end_right()) {
+      throw std::out_of_range("at_right fail");
+    }
+    return *it.flip();
+  }
+
+  using base::at_left;
+  using base::at_right;
+  using base::begin_left;
+  using base::begin_right;
+  using base::empty;
+  using base::end_left;
+  using base::end_right;
+  using base::find_left;
+  using base::find_right;
+  using base::lower_bound_left;
+  using base::lower_bound_right;
+  using base::size;
+  using base::upper_bound_left;
+  using base::upper_bound_right;
+
+  // The pair that the next eviction would remove.
+  left_iterator oldest() const {
+    if (empty()) {
+      return end_left();
+    }
+    return base::iterator_to(static_cast<const node_t*>(recency.newer));
+  }
+
+  friend bool operator==(bounded_bimap const& a, bounded_bimap const& b) {
+    return static_cast<base const&>(a) == static_cast<base const&>(b);
+  }
+
+  friend bool operator!=(bounded_bimap const& a, bounded_bimap const& b) {
+    return !(a == b);
+  }
+};
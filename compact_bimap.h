@@ -0,0 +1,643 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+// Storage mode of bimap for large maps of small pairs: all nodes live in one
+// contiguous pool, tree links are 32-bit indices into it, and treap
+// priorities are derived from the slot index instead of being stored.
+// For bimap<int, int> a pair costs 32 bytes of pool instead of a separately
+// allocated 104-byte Node.
+template <typename Left, typename Right, typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>>
+class compact_bimap {
+
+  using left_t = Left;
+  using right_t = Right;
+  using index_t = uint32_t;
+
+  static constexpr index_t nil = UINT32_MAX;
+  // Stored in top[0] of a free slot; child[0][0] then chains the free list.
+  static constexpr index_t dead = UINT32_MAX - 1;
+  static constexpr int left_side = 0;
+  static constexpr int right_side = 1;
+
+  struct Node {
+    index_t child[2][2]; // [side][0 - left child, 1 - right child]
+    index_t top[2];
+    union {
+      Left left_value;
+    };
+    union {
+      Right right_value;
+    };
+
+    Node() {}
+    ~Node() {}
+  };
+
+  template <class Compare, int Side>
+  struct compare_holder : Compare {
+    compare_holder(Compare compare) : Compare(std::move(compare)) {}
+  };
+
+  using left_compare = compare_holder<CompareLeft, left_side>;
+  using right_compare = compare_holder<CompareRight, right_side>;
+
+  struct state : left_compare, right_compare {
+    state(CompareLeft compare_left, CompareRight compare_right)
+        : left_compare(std::move(compare_left)),
+          right_compare(std::move(compare_right)) {}
+
+    std::unique_ptr<Node[]> pool;
+    index_t capacity = 0;
+    index_t used = 0;
+    index_t free_head = nil;
+    index_t root[2] = {nil, nil};
+    size_t map_size = 0;
+  };
+
+  state st;
+
+  template <int Side>
+  const auto& value(index_t i) const {
+    if constexpr (Side == left_side) {
+      return st.pool[i].left_value;
+    } else {
+      return st.pool[i].right_value;
+    }
+  }
+
+  template <int Side, class A, class B>
+  bool less(A const& a, B const& b) const {
+    if constexpr (Side == left_side) {
+      return static_cast<left_compare const&>(st)(a, b);
+    } else {
+      return static_cast<right_compare const&>(st)(a, b);
+    }
+  }
+
+  // murmur3 finalizer: a bijection, so distinct slots never tie.
+  static uint32_t priority(index_t i) {
+    uint32_t x = i;
+    x ^= x >> 16;
+    x *= 0x85ebca6bu;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35u;
+    x ^= x >> 16;
+    return x;
+  }
+
+  template <int Side>
+  void set_child(index_t parent, int dir, index_t child) {
+    st.pool[parent].child[Side][dir] = child;
+    if (child != nil) {
+      st.pool[child].top[Side] = parent;
+    }
+  }
+
+  template <int Side, class Key>
+  std::pair<index_t, index_t> split(index_t node, Key const& key) {
+    if (node == nil) {
+      return {nil, nil};
+    }
+    if (less<Side>(value<Side>(node), key)) {
+      auto pair = split<Side>(st.pool[node].child[Side][1], key);
+      set_child<Side>(node, 1, pair.first);
+      return {node, pair.second};
+    } else {
+      auto pair = split<Side>(st.pool[node].child[Side][0], key);
+      set_child<Side>(node, 0, pair.second);
+      return {pair.first, node};
+    }
+  }
+
+  template <int Side>
+  index_t merge(index_t left, index_t right) {
+    if (right == nil) {
+      return left;
+    }
+    if (left == nil) {
+      return right;
+    }
+    if (priority(left) > priority(right)) {
+      set_child<Side>(left, 1, merge<Side>(st.pool[left].child[Side][1], right));
+      return left;
+    } else {
+      set_child<Side>(right, 0, merge<Side>(left, st.pool[right].child[Side][0]));
+      return right;
+    }
+  }
+
+  template <int Side>
+  void set_root(index_t node) {
+    st.root[Side] = node;
+    if (node != nil) {
+      st.pool[node].top[Side] = nil;
+    }
+  }
+
+  template <int Side>
+  void link(index_t node) {
+    auto pair = split<Side>(st.root[Side], value<Side>(node));
+    set_root<Side>(merge<Side>(merge<Side>(pair.first, node), pair.second));
+  }
+
+  template <int Side>
+  void unlink(index_t node) {
+    Node& n = st.pool[node];
+    index_t sub = merge<Side>(n.child[Side][0], n.child[Side][1]);
+    index_t parent = n.top[Side];
+    if (parent == nil) {
+      set_root<Side>(sub);
+      return;
+    }
+    Node& p = st.pool[parent];
+    set_child<Side>(parent, p.child[Side][0] == node ? 0 : 1, sub);
+  }
+
+  template <int Side, class Key>
+  index_t find(Key const& key) const {
+    index_t cur = st.root[Side];
+    while (cur != nil) {
+      if (less<Side>(key, value<Side>(cur))) {
+        cur = st.pool[cur].child[Side][0];
+      } else if (less<Side>(value<Side>(cur), key)) {
+        cur = st.pool[cur].child[Side][1];
+      } else {
+        return cur;
+      }
+    }
+    return nil;
+  }
+
+  // First node that is not less than key (Strict = false) or that is
+  // greater than key (Strict = true); one descent, comparator only.
+  template <int Side, bool Strict, class Key>
+  index_t bound(Key const& key) const {
+    index_t cur = st.root[Side];
+    index_t result = nil;
+    while (cur != nil) {
+      bool go_left = Strict ? less<Side>(key, value<Side>(cur))
+                            : !less<Side>(value<Side>(cur), key);
+      if (go_left) {
+        result = cur;
+        cur = st.pool[cur].child[Side][0];
+      } else {
+        cur = st.pool[cur].child[Side][1];
+      }
+    }
+    return result;
+  }
+
+  template <int Side, int Dir>
+  index_t extreme(index_t node) const {
+    if (node == nil) {
+      return nil;
+    }
+    while (st.pool[node].child[Side][Dir] != nil) {
+      node = st.pool[node].child[Side][Dir];
+    }
+    return node;
+  }
+
+  // In-order neighbour in direction Dir (1 - next, 0 - prev); stepping from
+  // nil (end) backwards gives the maximum.
+  template <int Side, int Dir>
+  index_t step(index_t node) const {
+    if (node == nil) {
+      return extreme<Side, 1 - Dir>(st.root[Side]);
+    }
+    if (st.pool[node].child[Side][Dir] != nil) {
+      return extreme<Side, 1 - Dir>(st.pool[node].child[Side][Dir]);
+    }
+    index_t parent = st.pool[node].top[Side];
+    while (parent != nil && st.pool[parent].child[Side][Dir] == node) {
+      node = parent;
+      parent = st.pool[node].top[Side];
+    }
+    return parent;
+  }
+
+  static void copy_links(Node const& from, Node& to) {
+    for (int side = 0; side < 2; side++) {
+      to.child[side][0] = from.child[side][0];
+      to.child[side][1] = from.child[side][1];
+      to.top[side] = from.top[side];
+    }
+  }
+
+  void grow() {
+    if (st.capacity >= dead) {
+      throw std::length_error("compact_bimap is full");
+    }
+    index_t new_capacity = st.capacity == 0 ? 8
+                           : st.capacity > dead / 2 ? dead
+                                                    : st.capacity * 2;
+    auto pool = std::make_unique<Node[]>(new_capacity);
+    // Pairs are moved only if neither move can throw and copied otherwise,
+    // and the old ones are destroyed once all are in place, so a throwing
+    // constructor leaves the map as it was.
+    constexpr bool move_pairs =
+        std::is_nothrow_move_constructible<Left>::value &&
+        std::is_nothrow_move_constructible<Right>::value;
+    auto relay = [](auto& value) -> decltype(auto) {
+      if constexpr (move_pairs) {
+        return std::move(value);
+      } else {
+        return std::as_const(value);
+      }
+    };
+    index_t i = 0;
+    bool left_done = false;
+    try {
+      for (; i < st.used; i++) {
+        Node& from = st.pool[i];
+        Node& to = pool[i];
+        copy_links(from, to);
+        if (from.top[0] != dead) {
+          new (&to.left_value) Left(relay(from.left_value));
+          left_done = true;
+          new (&to.right_value) Right(relay(from.right_value));
+          left_done = false;
+        }
+      }
+    } catch (...) {
+      if (left_done) {
+        pool[i].left_value.~Left();
+      }
+      for (index_t j = 0; j < i; j++) {
+        if (st.pool[j].top[0] != dead) {
+          pool[j].left_value.~Left();
+          pool[j].right_value.~Right();
+        }
+      }
+      throw;
+    }
+    for (i = 0; i < st.used; i++) {
+      if (st.pool[i].top[0] != dead) {
+        destroy(i);
+      }
+    }
+    st.pool = std::move(pool);
+    st.capacity = new_capacity;
+  }
+
+  // Constructs the pair in the first free slot; the slot stays on the free
+  // list if a constructor throws.
+  template <class LeftArg, class RightArg>
+  index_t allocate(LeftArg&& left, RightArg&& right) {
+    if (st.free_head == nil) {
+      if (st.used == st.capacity) {
+        grow();
+      }
+      st.pool[st.used].top[0] = dead;
+      st.pool[st.used].child[0][0] = nil;
+      st.free_head = st.used++;
+    }
+    index_t i = st.free_head;
+    Node& n = st.pool[i];
+    new (&n.left_value) Left(std::forward<LeftArg>(left));
+    try {
+      new (&n.right_value) Right(std::forward<RightArg>(right));
+    } catch (...) {
+      n.left_value.~Left();
+      throw;
+    }
+    st.free_head = n.child[0][0];
+    for (int side = 0; side < 2; side++) {
+      n.child[side][0] = n.child[side][1] = n.top[side] = nil;
+    }
+    return i;
+  }
+
+  void destroy(index_t i) {
+    st.pool[i].left_value.~Left();
+    st.pool[i].right_value.~Right();
+  }
+
+  void deallocate(index_t i) {
+    destroy(i);
+    st.pool[i].top[0] = dead;
+    st.pool[i].child[0][0] = st.free_head;
+    st.free_head = i;
+  }
+
+  void erase_node(index_t i) {
+    unlink<left_side>(i);
+    unlink<right_side>(i);
+    deallocate(i);
+    st.map_size--;
+  }
+
+  void delete_all() {
+    for (index_t i = 0; i < st.used; i++) {
+      if (st.pool[i].top[0] != dead) {
+        destroy(i);
+      }
+    }
+    st.pool.reset();
+    st.capacity = st.used = 0;
+    st.free_head = st.root[0] = st.root[1] = nil;
+    st.map_size = 0;
+  }
+
+  template <int Side, class Value, class Derived>
+  class base_iterator {
+  protected:
+    const compact_bimap* map;
+    index_t index;
+    base_iterator(const compact_bimap* map, index_t index)
+        : map(map), index(index) {}
+
+  public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = const Value;
+    using difference_type = std::ptrdiff_t;
+    using pointer = Value const*;
+    using reference = Value const&;
+
+    Value const& operator*() const {
+      return map->template value<Side>(index);
+    }
+
+    Value const* operator->() const {
+      return &(*(*this));
+    }
+
+    Derived& operator++() {
+      index = map->template step<Side, 1>(index);
+      return static_cast<Derived&>(*this);
+    }
+
+    Derived operator++(int) {
+      Derived temp = static_cast<Derived&>(*this);
+      ++*this;
+      return temp;
+    }
+
+    Derived& operator--() {
+      index = map->template step<Side, 0>(index);
+      return static_cast<Derived&>(*this);
+    }
+
+    Derived operator--(int) {
+      Derived temp = static_cast<Derived&>(*this);
+      --*this;
+      return temp;
+    }
+
+    bool operator==(const base_iterator& rhs) const {
+      return index == rhs.index;
+    }
+
+    bool operator!=(const base_iterator& rhs) const {
+      return !(*this == rhs);
+    }
+  };
+
+  class right_iterator;
+
+  class left_iterator
+      : public base_iterator<left_side, Left, left_iterator> {
+    friend class compact_bimap;
+
+    left_iterator(const compact_bimap* map, index_t index)
+        : base_iterator<left_side, Left, left_iterator>(map, index) {}
+
+  public:
+    right_iterator flip() const {
+      return right_iterator(this->map, this->index);
+    }
+  };
+
+  class right_iterator
+      : public base_iterator<right_side, Right, right_iterator> {
+    friend class compact_bimap;
+
+    right_iterator(const compact_bimap* map, index_t index)
+        : base_iterator<right_side, Right, right_iterator>(map, index) {}
+
+  public:
+    left_iterator flip() const {
+      return left_iterator(this->map, this->index);
+    }
+  };
+
+public:
+  compact_bimap(CompareLeft compare_left = CompareLeft(),
+                CompareRight compare_right = CompareRight())
+      : st(std::move(compare_left), std::move(compare_right)) {}
+
+  // Slots keep their indices, so a copy is a link-for-link image of other.
+  compact_bimap(compact_bimap const& other)
+      : st(static_cast<left_compare const&>(other.st),
+           static_cast<right_compare const&>(other.st)) {
+    if (other.st.used == 0) {
+      return;
+    }
+    st.pool = std::make_unique<Node[]>(other.st.used);
+    st.capacity = other.st.used;
+    for (; st.used < other.st.used; st.used++) {
+      Node const& from = other.st.pool[st.used];
+      Node& to = st.pool[st.used];
+      if (from.top[0] != dead) {
+        try {
+          new (&to.left_value) Left(from.left_value);
+          try {
+            new (&to.right_value) Right(from.right_value);
+          } catch (...) {
+            to.left_value.~Left();
+            throw;
+          }
+        } catch (...) {
+          delete_all();
+          throw;
+        }
+      }
+      copy_links(from, to);
+    }
+    st.free_head = other.st.free_head;
+    st.root[0] = other.st.root[0];
+    st.root[1] = other.st.root[1];
+    st.map_size = other.st.map_size;
+  }
+
+  compact_bimap(compact_bimap&& other) noexcept : compact_bimap() {
+    swap(other);
+  }
+
+  compact_bimap& operator=(compact_bimap const& other) {
+    if (this != &other) {
+      compact_bimap(other).swap(*this);
+    }
+    return *this;
+  }
+
+  compact_bimap& operator=(compact_bimap&& other) noexcept {
+    if (this != &other) {
+      delete_all();
+      swap(other);
+    }
+    return *this;
+  }
+
+  ~compact_bimap() noexcept {
+    delete_all();
+  }
+
+  void swap(compact_bimap& other) {
+    std::swap(st, other.st);
+  }
+
+  template <class LeftArg = left_t, class RightArg = right_t>
+  left_iterator insert(LeftArg&& left, RightArg&& right) {
+    if (find<left_side>(left) != nil || find<right_side>(right) != nil) {
+      return end_left();
+    }
+    index_t i =
+        allocate(std::forward<LeftArg>(left), std::forward<RightArg>(right));
+    link<left_side>(i);
+    link<right_side>(i);
+    st.map_size++;
+    return left_iterator(this, i);
+  }
+
+  left_iterator erase_left(left_iterator it) {
+    index_t i = it.index;
+    ++it;
+    erase_node(i);
+    return it;
+  }
+
+  bool erase_left(left_t const& left) {
+    index_t i = find<left_side>(left);
+    if (i == nil) {
+      return false;
+    }
+    erase_node(i);
+    return true;
+  }
+
+  right_iterator erase_right(right_iterator it) {
+    index_t i = it.index;
+    ++it;
+    erase_node(i);
+    return it;
+  }
+
+  bool erase_right(right_t const& right) {
+    index_t i = find<right_side>(right);
+    if (i == nil) {
+      return false;
+    }
+    erase_node(i);
+    return true;
+  }
+
+  left_iterator erase_left(left_iterator first, left_iterator last) {
+    while (first != last) {
+      first = erase_left(first);
+    }
+    return last;
+  }
+
+  right_iterator erase_right(right_iterator first, right_iterator last) {
+    while (first != last) {
+      first = erase_right(first);
+    }
+    return last;
+  }
+
+  left_iterator find_left(left_t const& left) const {
+    return left_iterator(this, find<left_side>(left));
+  }
+
+  right_iterator find_right(right_t const& right) const {
+    return right_iterator(this, find<right_side>(right));
+  }
+
+  right_t const& at_left(left_t const& key) const {
+    index_t i = find<left_side>(key);
+    if (i == nil) {
+      throw std::out_of_range("at_left fail");
+    }
+    return value<right_side>(i);
+  }
+
+  left_t const& at_right(right_t const& key) const {
+    index_t i = find<right_side>(key);
+    if (i == nil) {
+      throw std::out_of_range("at_right fail");
+    }
+    return value<left_side>(i);
+  }
+
+  left_iterator lower_bound_left(const left_t& left) const {
+    return left_iterator(this, bound<left_side, false>(left));
+  }
+
+  left_iterator upper_bound_left(const left_t& left) const {
+    return left_iterator(this, bound<left_side, true>(left));
+  }
+
+  right_iterator lower_bound_right(const right_t& right) const {
+    return right_iterator(this, bound<right_side, false>(right));
+  }
+
+  right_iterator upper_bound_right(const right_t& right) const {
+    return right_iterator(this, bound<right_side, true>(right));
+  }
+
+  left_iterator begin_left() const {
+    return left_iterator(this, extreme<left_side, 0>(st.root[left_side]));
+  }
+
+  left_iterator end_left() const {
+    return left_iterator(this, nil);
+  }
+
+  right_iterator begin_right() const {
+    return right_iterator(this, extreme<right_side, 0>(st.root[right_side]));
+  }
+
+  right_iterator end_right() const {
+    return right_iterator(this, nil);
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  std::size_t size() const {
+    return st.map_size;
+  }
+
+  // Bytes held by the node pool, including free and not yet used slots.
+  std::size_t memory_usage() const {
+    return std::size_t(st.capacity) * sizeof(Node);
+  }
+
+  friend bool operator==(compact_bimap const& a, compact_bimap const& b) {
+    if (a.size() != b.size()) {
+      return false;
+    }
+    for (auto ita = a.begin_left(), itb = b.begin_left(); ita != a.end_left();
+         ++ita, ++itb) {
+      if (*ita != *itb || *ita.flip() != *itb.flip()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  friend bool operator!=(compact_bimap const& a, compact_bimap const& b) {
+    return !(a == b);
+  }
+};
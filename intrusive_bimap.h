@@ -0,0 +1,357 @@
+#pragma once
+#include "intrusive_cartesian_tree.h"
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+template <class Tag>
+struct IntrusiveLeftTag {};
+
+template <class Tag>
+struct IntrusiveRightTag {};
+
+// Base of objects that can be linked into an intrusive_bimap. Tag tells
+// apart the hooks of an object indexed by several maps. Copies start
+// unlinked, so copying a linked object never corrupts a map.
+template <class Tag = void>
+struct intrusive_bimap_hook : public IntrusiveNode<IntrusiveLeftTag<Tag>>,
+                              public IntrusiveNode<IntrusiveRightTag<Tag>> {
+  intrusive_bimap_hook() = default;
+
+  intrusive_bimap_hook(const intrusive_bimap_hook&)
+      : IntrusiveNode<IntrusiveLeftTag<Tag>>(),
+        IntrusiveNode<IntrusiveRightTag<Tag>>() {}
+
+  intrusive_bimap_hook& operator=(const intrusive_bimap_hook&) {
+    return *this;
+  }
+
+  bool is_linked() const {
+    return static_cast<const IntrusiveNode<IntrusiveLeftTag<Tag>>&>(*this)
+               .top != nullptr;
+  }
+};
+
+template <class T, class KeyOf>
+using intrusive_key_t =
+    std::decay_t<decltype(std::declval<KeyOf>()(std::declval<const T&>()))>;
+
+// KeyOf of the trees: reads the key through the user's extractor. There is
+// no room for a key_cache in the user's object, so the cache is the empty
+// one of the void comparator.
+template <class T, class Hook, class Side, class KeyOf>
+struct HookKeyOf {
+  decltype(auto) operator()(const IntrusiveNode<Side>* node) const {
+    return KeyOf()(static_cast<const T&>(static_cast<const Hook&>(*node)));
+  }
+
+  static key_cache<intrusive_key_t<T, KeyOf>, void>
+  cache(const IntrusiveNode<Side>*) {
+    return {};
+  }
+};
+
+// A bimap over objects owned by the caller: T derives from
+// intrusive_bimap_hook<Tag>, and LeftKeyOf / RightKeyOf return references
+// to its two keys, e.g.
+//
+//   struct connection : intrusive_bimap_hook<> {
+//     int socket;
+//     std::string session;
+//   };
+//   struct by_socket {
+//     const int& operator()(const connection& c) const { return c.socket; }
+//   };
+//
+// Insert and erase only link and unlink the object: nothing is allocated
+// or copied, and iterator_to_left / iterator_to_right are O(1). Objects
+// must stay in place and keep their keys while linked; the map unlinks all
+// of them when destroyed.
+template <class T, class LeftKeyOf, class RightKeyOf,
+          class CompareLeft = std::less<intrusive_key_t<T, LeftKeyOf>>,
+          class CompareRight = std::less<intrusive_key_t<T, RightKeyOf>>,
+          class Tag = void>
+class intrusive_bimap {
+  using hook_t = intrusive_bimap_hook<Tag>;
+  using left_tag = IntrusiveLeftTag<Tag>;
+  using right_tag = IntrusiveRightTag<Tag>;
+
+  static_assert(std::is_base_of<hook_t, T>::value,
+                "T must derive from intrusive_bimap_hook<Tag>");
+  static_assert(
+      std::is_lvalue_reference<decltype(std::declval<LeftKeyOf>()(
+          std::declval<const T&>()))>::value &&
+          std::is_lvalue_reference<decltype(std::declval<RightKeyOf>()(
+              std::declval<const T&>()))>::value,
+      "key extractors must return references into the object");
+
+public:
+  using left_t = intrusive_key_t<T, LeftKeyOf>;
+  using right_t = intrusive_key_t<T, RightKeyOf>;
+
+private:
+  using left_tree_t = IntrusiveCartesianTree<
+      left_tag, left_t, CompareLeft, HookKeyOf<T, hook_t, left_tag, LeftKeyOf>>;
+  using right_tree_t =
+      IntrusiveCartesianTree<right_tag, right_t, CompareRight,
+                             HookKeyOf<T, hook_t, right_tag, RightKeyOf>>;
+
+  hook_t head;
+  left_tree_t left_set;
+  right_tree_t right_set;
+  std::size_t map_size = 0;
+
+  template <class Side>
+  static T& object_of(const IntrusiveNode<Side>* node) {
+    return const_cast<T&>(
+        static_cast<const T&>(static_cast<const hook_t&>(*node)));
+  }
+
+  // Back to the state of a hook that was never linked.
+  template <class Side>
+  static void reset(IntrusiveNode<Side>& node) {
+    node.left = node.right = node.top = nullptr;
+    node.succ = node.pred = nullptr;
+  }
+
+  void unlink(T& object) {
+    left_set.unlink(&object);
+    right_set.unlink(&object);
+    reset<left_tag>(object);
+    reset<right_tag>(object);
+    map_size--;
+  }
+
+  template <class Side>
+  void swap_head(intrusive_bimap& other) {
+    std::swap(static_cast<IntrusiveNode<Side>&>(head),
+              static_cast<IntrusiveNode<Side>&>(other.head));
+  }
+
+  template <class Side, class OtherSide>
+  class base_iterator {
+    friend class intrusive_bimap;
+
+    const IntrusiveNode<Side>* node_ptr;
+
+    explicit base_iterator(const IntrusiveNode<Side>* node_ptr)
+        : node_ptr(node_ptr) {}
+
+  public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = T*;
+    using reference = T&;
+
+    T& operator*() const {
+      return object_of(node_ptr);
+    }
+
+    T* operator->() const {
+      return &object_of(node_ptr);
+    }
+
+    base_iterator& operator++() {
+      node_ptr = node_ptr->next();
+      return *this;
+    }
+
+    base_iterator operator++(int) {
+      base_iterator temp = *this;
+      ++*this;
+      return temp;
+    }
+
+    base_iterator& operator--() {
+      node_ptr = node_ptr->prev();
+      return *this;
+    }
+
+    base_iterator operator--(int) {
+      base_iterator temp = *this;
+      --*this;
+      return temp;
+    }
+
+    bool operator==(const base_iterator& rhs) const {
+      return node_ptr == rhs.node_ptr;
+    }
+
+    bool operator!=(const base_iterator& rhs) const {
+      return !(*this == rhs);
+    }
+
+    // The same object in the order of the other key; end() flips to end().
+    base_iterator<OtherSide, Side> flip() const {
+      return base_iterator<OtherSide, Side>(
+          static_cast<const IntrusiveNode<OtherSide>*>(
+              static_cast<const hook_t*>(node_ptr)));
+    }
+  };
+
+public:
+  using left_iterator = base_iterator<left_tag, right_tag>;
+  using right_iterator = base_iterator<right_tag, left_tag>;
+
+  explicit intrusive_bimap(CompareLeft compare_left = CompareLeft(),
+                           CompareRight compare_right = CompareRight())
+      : left_set(&head, compare_left), right_set(&head, compare_right) {}
+
+  intrusive_bimap(intrusive_bimap const&) = delete;
+  intrusive_bimap& operator=(intrusive_bimap const&) = delete;
+
+  intrusive_bimap(intrusive_bimap&& other) noexcept
+      : intrusive_bimap(other.left_set.value_comp(),
+                        other.right_set.value_comp()) {
+    swap(other);
+  }
+
+  intrusive_bimap& operator=(intrusive_bimap&& other) noexcept {
+    if (this != &other) {
+      clear();
+      swap(other);
+    }
+    return *this;
+  }
+
+  ~intrusive_bimap() {
+    clear();
+  }
+
+  void swap(intrusive_bimap& other) {
+    swap_head<left_tag>(other);
+    swap_head<right_tag>(other);
+    std::swap(map_size, other.map_size);
+    left_set = left_tree_t(&head);
+    right_set = right_tree_t(&head);
+    other.left_set = left_tree_t(&other.head);
+    other.right_set = right_tree_t(&other.head);
+    left_set.swap_comparator(other.left_set);
+    right_set.swap_comparator(other.right_set);
+  }
+
+  // Links object unless it is already linked, into this or another map of
+  // the same Tag, or one of its keys is already present; returns its left
+  // iterator or end_left().
+  left_iterator insert(T& object) {
+    if (object.is_linked()) {
+      return end_left();
+    }
+    auto left_at = left_set.locate(LeftKeyOf()(object));
+    auto right_at = right_set.locate(RightKeyOf()(object));
+    if (left_at.second || right_at.second) {
+      return end_left();
+    }
+    left_set.insert_before(left_at.first, &object);
+    right_set.insert_before(right_at.first, &object);
+    map_size++;
+    return left_iterator(&object);
+  }
+
+  // Unlinks object, which must be linked into this map.
+  void erase(T& object) {
+    unlink(object);
+  }
+
+  left_iterator erase_left(left_iterator it) {
+    auto next = std::next(it);
+    unlink(*it);
+    return next;
+  }
+
+  right_iterator erase_right(right_iterator it) {
+    auto next = std::next(it);
+    unlink(*it);
+    return next;
+  }
+
+  // Unlinks the object with the given key and returns it, or nullptr.
+  T* erase_left(left_t const& left) {
+    auto found = left_set.find(left);
+    if (found == nullptr) {
+      return nullptr;
+    }
+    T& object = object_of(found);
+    unlink(object);
+    return &object;
+  }
+
+  T* erase_right(right_t const& right) {
+    auto found = right_set.find(right);
+    if (found == nullptr) {
+      return nullptr;
+    }
+    T& object = object_of(found);
+    unlink(object);
+    return &object;
+  }
+
+  // Unlinks every object; O(n).
+  void clear() {
+    while (!empty()) {
+      unlink(*begin_left());
+    }
+  }
+
+  left_iterator find_left(left_t const& left) const {
+    auto found = left_set.find(left);
+    return found == nullptr ? end_left() : left_iterator(found);
+  }
+
+  right_iterator find_right(right_t const& right) const {
+    auto found = right_set.find(right);
+    return found == nullptr ? end_right() : right_iterator(found);
+  }
+
+  // Iterators of a linked object without a search.
+  left_iterator iterator_to_left(T const& object) const {
+    return left_iterator(&object);
+  }
+
+  right_iterator iterator_to_right(T const& object) const {
+    return right_iterator(&object);
+  }
+
+  left_iterator lower_bound_left(left_t const& left) const {
+    return left_iterator(left_set.lower_bound(left));
+  }
+
+  left_iterator upper_bound_left(left_t const& left) const {
+    return left_iterator(left_set.upper_bound(left));
+  }
+
+  right_iterator lower_bound_right(right_t const& right) const {
+    return right_iterator(right_set.lower_bound(right));
+  }
+
+  right_iterator upper_bound_right(right_t const& right) const {
+    return right_iterator(right_set.upper_bound(right));
+  }
+
+  left_iterator begin_left() const {
+    return left_iterator(left_set.begin());
+  }
+
+  left_iterator end_left() const {
+    return left_iterator(left_set.end());
+  }
+
+  right_iterator begin_right() const {
+    return right_iterator(right_set.begin());
+  }
+
+  right_iterator end_right() const {
+    return right_iterator(right_set.end());
+  }
+
+  bool empty() const {
+    return map_size == 0;
+  }
+
+  std::size_t size() const {
+    return map_size;
+  }
+};
@@ -1,8 +1,20 @@
 #pragma once
+#include "key_cache.h"
 #include "nodes.h"
+#include <cstddef>
 #include <random>
+#include <type_traits>
+#include <utility>
 
-template <class Tag, class Value, class LessComparator = std::less<Value>>
+// KeyOf maps a hook of the tree to the key stored in the enclosing node and,
+// through KeyOf::cache, to the key_cache kept next to the hook.
+//
+// Augment, if not void, keeps an aggregate of every subtree in its nodes:
+// value_type, identity(), an associative combine(a, b), single(node) for
+// the node alone, subtree(node) and store(node, value) for the kept one.
+// Every change of links recomputes the aggregates it affects.
+template <class Tag, class Value, class LessComparator, class KeyOf,
+          class Augment = void>
 class IntrusiveCartesianTree : private LessComparator {
 private:
 
@@ -11,17 +23,97 @@ private:
   std::mt19937 gen;
   std::uniform_int_distribution<int> dist;
 
+  static constexpr size_t batch_group = 8;
+
+  // Adaptive mode: levels a found node may rise per lookup, 0 if off.
+  size_t promote_budget = 0;
+
+  using cache_t = std::decay_t<decltype(
+      KeyOf::cache(std::declval<const IntrusiveNode<Tag>*>()))>;
+
+  // A searched key with its cache computed once per query.
+  struct probe {
+    const Value& value;
+    cache_t cache;
+
+    explicit probe(const Value& value) : value(value), cache(value) {}
+    probe(const Value& value, const cache_t& cache)
+        : value(value), cache(cache) {}
+    explicit probe(const IntrusiveNode<Tag>* node)
+        : value(KeyOf()(node)), cache(KeyOf::cache(node)) {}
+  };
+
+  bool less(const probe& key, const IntrusiveNode<Tag>* node) const {
+    int order = cache_t::compare(key.cache, KeyOf::cache(node));
+    if (order != 0 || is_exact_cache<cache_t>::value) {
+      return order < 0;
+    }
+    return LessComparator::operator()(key.value, get_value(node));
+  }
+
+  bool less(const IntrusiveNode<Tag>* node, const probe& key) const {
+    int order = cache_t::compare(KeyOf::cache(node), key.cache);
+    if (order != 0 || is_exact_cache<cache_t>::value) {
+      return order < 0;
+    }
+    return LessComparator::operator()(get_value(node), key.value);
+  }
+
+  static constexpr bool augmented = !std::is_void<Augment>::value;
+
+  // Recomputes the aggregate of node from those of its children.
+  static void update(IntrusiveNode<Tag>* node) {
+    if constexpr (augmented) {
+      auto value = Augment::single(node);
+      if (node->left != nullptr) {
+        value = Augment::combine(Augment::subtree(node->left), value);
+      }
+      if (node->right != nullptr) {
+        value = Augment::combine(value, Augment::subtree(node->right));
+      }
+      Augment::store(node, std::move(value));
+    }
+  }
+
+  static void update_subtree(IntrusiveNode<Tag>* node) {
+    if constexpr (augmented) {
+      if (node != nullptr) {
+        update_subtree(node->left);
+        update_subtree(node->right);
+        update(node);
+      }
+    }
+  }
+
+  void update_path(IntrusiveNode<Tag>* node) {
+    if constexpr (augmented) {
+      for (; node != head; node = node->top) {
+        update(node);
+      }
+    }
+  }
+
+  static void prefetch(const void* ptr) {
+#if defined(__GNUC__) || defined(__clang__)
+    if (ptr != nullptr) {
+      __builtin_prefetch(ptr);
+    }
+#endif
+  }
+
   std::pair<IntrusiveNode<Tag>*, IntrusiveNode<Tag>*>
-  split(IntrusiveNode<Tag>* node, const Value& split_value) {
+  split(IntrusiveNode<Tag>* node, const probe& split_value) {
     if (node == nullptr) {
       return {nullptr, nullptr};
-    } else if (LessComparator::operator()(get_value(node), split_value)) {
+    } else if (less(node, split_value)) {
       auto pair = split(node->right, split_value);
       link_right(node, pair.first);
+      update(node);
       return remove_tops(node, pair.second);
     } else {
       auto pair = split(node->left, split_value);
       link_left(node, pair.second);
+      update(node);
       return remove_tops(pair.first, node);
     }
   }
@@ -47,10 +139,12 @@ private:
     }
     if (left->weight > right->weight) {
       link_right(left, merge(left->right, right));
+      update(left);
       left->top = nullptr;
       return left;
     } else {
       link_left(right, merge(left, right->left));
+      update(right);
       right->top = nullptr;
       return right;
     }
@@ -74,30 +168,141 @@ private:
     }
   }
 
-  const IntrusiveNode<Tag>* find(const Value& value,
+  IntrusiveNode<Tag>* rightmost(IntrusiveNode<Tag>* node) const {
+    if (node == nullptr) {
+      return head;
+    }
+    while (node->right != nullptr) {
+      node = node->right;
+    }
+    return node;
+  }
+
+  void link_after(IntrusiveNode<Tag>* prev, IntrusiveNode<Tag>* node) {
+    node->pred = prev;
+    node->succ = prev->succ;
+    prev->succ->pred = node;
+    prev->succ = node;
+  }
+
+  template <bool Strict>
+  const IntrusiveNode<Tag>* bound_from(const IntrusiveNode<Tag>* node,
+                                       const probe& value) const {
+    const IntrusiveNode<Tag>* last;
+    bool went_left;
+    do {
+      last = node;
+      went_left = Strict ? less(value, node) : !less(node, value);
+      node = went_left ? node->left : node->right;
+    } while (node != nullptr);
+    return went_left ? last : last->succ;
+  }
+
+  // Lowest ancestor of node (or node itself) whose subtree spans the
+  // position of value.
+  const IntrusiveNode<Tag>* finger_root(const IntrusiveNode<Tag>* node,
+                                        const probe& value) const {
+    bool go_left = less(value, node);
+    if (!go_left && !less(node, value)) {
+      return node;
+    }
+    while (node->top != head) {
+      auto parent = node->top;
+      bool bounds_node = go_left ? parent->right == node : parent->left == node;
+      if (bounds_node &&
+          (go_left ? less(parent, value) : less(value, parent))) {
+        break;
+      }
+      node = parent;
+    }
+    return node;
+  }
+
+  void rotate_up(IntrusiveNode<Tag>* node) {
+    auto parent = node->top;
+    auto grand = parent->top;
+    if (parent->left == node) {
+      link_left(parent, node->right);
+      link_right(node, parent);
+    } else {
+      link_right(parent, node->left);
+      link_left(node, parent);
+    }
+    if (grand->left == parent) {
+      link_left(grand, node);
+    } else {
+      link_right(grand, node);
+    }
+    update(parent);
+    update(node);
+  }
+
+  // Moves a found node a share of the way to the top priority and rotates
+  // it up, but never above its promote_budget + 1-th ancestor. Hot keys
+  // climb towards the root, pushing colder ones down; heap order and the
+  // threads are kept.
+  void promote(IntrusiveNode<Tag>* node) {
+    auto limit = node->top;
+    for (size_t i = 0; i < promote_budget && limit != head; i++) {
+      limit = limit->top;
+    }
+    int raised = node->weight + (INT_MAX - 1 - node->weight) / 8;
+    node->weight = raised < limit->weight ? raised : limit->weight;
+    while (node->weight > node->top->weight) {
+      rotate_up(node);
+    }
+  }
+
+  const IntrusiveNode<Tag>* find(const probe& value,
                                  const IntrusiveNode<Tag>* node) const {
     if (node == nullptr) {
       return nullptr;
     }
-    if (LessComparator::operator()(value, get_value(node))) {
+    if (less(value, node)) {
       return find(value, node->left);
     }
-    if (LessComparator::operator()(get_value(node), value)) {
+    if (less(node, value)) {
       return find(value, node->right);
     }
     return node;
   }
 
 public:
+  // A key with its cache, for callers that run several searches for the
+  // same key and want it summarized (e.g. projected) only once.
+  using key_probe = probe;
+
   IntrusiveCartesianTree(IntrusiveNode<Tag>* head,
                          LessComparator lessComp = LessComparator())
       : LessComparator(lessComp), head(head), dist(0, INT_MAX - 1), gen(rd()) {
     head->weight = INT_MAX;
+    relink_head();
+  }
+
+  // Points the root and the ends of the thread ring back at head after the
+  // head's links were copied from another head.
+  void relink_head() {
     if (head->left != nullptr) {
       head->left->top = head;
+      head->succ->pred = head;
+      head->pred->succ = head;
+    } else {
+      head->succ = head;
+      head->pred = head;
     }
   }
 
+  const LessComparator& value_comp() const {
+    return *this;
+  }
+
+  // Exchanges the comparators, for trees that exchange their nodes.
+  void swap_comparator(IntrusiveCartesianTree& other) {
+    using std::swap;
+    swap(static_cast<LessComparator&>(*this),
+         static_cast<LessComparator&>(other));
+  }
+
   IntrusiveCartesianTree& operator=(const IntrusiveCartesianTree& rhs) {
     if (this == &rhs) {
       return *this;
@@ -106,32 +311,237 @@ public:
     return *this;
   }
 
-  void insert(NodeBase<Value, Tag>* node) {
+  void insert(IntrusiveNode<Tag>* node) {
     node->weight = dist(gen);
-    auto split_by_value = split(head->left, node->value);
+    node->left = node->right = nullptr;
+    update(node);
+    auto split_by_value = split(head->left, probe(node));
+    link_after(rightmost(split_by_value.first), node);
     auto left_subtree = merge(split_by_value.first, node);
     link_left(head, merge(left_subtree, split_by_value.second));
   }
 
+  // Self-adjusting lookups for skewed workloads: with a non-zero budget
+  // every hit of find(value) promotes the found node by up to budget
+  // levels. Such a find rotates nodes although it is const, so a tree in
+  // this mode must not be searched concurrently; 0 turns it off.
+  void set_promote_budget(size_t budget) {
+    promote_budget = budget;
+  }
+
+  size_t get_promote_budget() const {
+    return promote_budget;
+  }
+
   const IntrusiveNode<Tag>* find(const Value& value) const {
-    return find(value, head->left);
+    auto found = find(probe(value), head->left);
+    if (found != nullptr && promote_budget != 0) {
+      const_cast<IntrusiveCartesianTree*>(this)->promote(
+          const_cast<IntrusiveNode<Tag>*>(found));
+    }
+    return found;
   }
 
-  IntrusiveNode<Tag>* remove(const Value& value) {
-    auto found = find(value, head->left);
-    if (found == nullptr) {
-      return nullptr;
+  // Looks up every key of [first, last) and passes the found node (or
+  // nullptr) to consume in input order. Descents of batch_group keys are
+  // advanced in lockstep and each next node is prefetched, so the cache
+  // misses of independent lookups overlap instead of being serialized.
+  template <class KeyIt, class Consumer>
+  void find_batch(KeyIt first, KeyIt last, Consumer&& consume) const {
+    const Value* keys[batch_group];
+    cache_t caches[batch_group];
+    const IntrusiveNode<Tag>* cur[batch_group];
+    bool done[batch_group];
+    while (first != last) {
+      size_t group = 0;
+      for (; group < batch_group && first != last; ++group, ++first) {
+        keys[group] = &*first;
+        caches[group] = cache_t(*first);
+        cur[group] = head->left;
+        done[group] = false;
+      }
+      size_t active = group;
+      while (active != 0) {
+        for (size_t i = 0; i < group; i++) {
+          if (done[i]) {
+            continue;
+          }
+          auto node = cur[i];
+          probe key(*keys[i], caches[i]);
+          if (node == nullptr) {
+            done[i] = true;
+            active--;
+          } else if (less(key, node)) {
+            cur[i] = node->left;
+            prefetch(cur[i]);
+          } else if (less(node, key)) {
+            cur[i] = node->right;
+            prefetch(cur[i]);
+          } else {
+            done[i] = true;
+            active--;
+          }
+        }
+      }
+      for (size_t i = 0; i < group; i++) {
+        consume(cur[i]);
+      }
     }
-    auto next_found = found->next();
-    auto split_by_value = split(head->left, value);
-    if (next_found == head) {
-      link_left(head, split_by_value.first);
+  }
+
+  // Calls visit for every node with lo <= key < hi in key order: a single
+  // descent to the first one, then a walk along the in-order threads.
+  template <class Visitor>
+  void for_each(const Value& lo, const Value& hi, Visitor&& visit) const {
+    probe last(hi);
+    for (auto first = lower_bound(lo); first != head && less(first, last);
+         first = first->succ) {
+      visit(first);
+    }
+  }
+
+  template <class Visitor>
+  void for_each(Visitor&& visit) const {
+    for (auto node = head->succ; node != head; node = node->succ) {
+      visit(node);
+    }
+  }
+
+  // Unlinks node in place: its children are merged into its slot, which
+  // touches O(1) nodes in expectation and needs no key comparisons.
+  void unlink(IntrusiveNode<Tag>* node) {
+    node->pred->succ = node->succ;
+    node->succ->pred = node->pred;
+    auto parent = node->top;
+    auto subtree = merge(node->left, node->right);
+    if (parent->left == node) {
+      link_left(parent, subtree);
     } else {
-      auto split_by_next_value =
-          split(split_by_value.second, get_value(next_found));
-      link_left(head, merge(split_by_value.first, split_by_next_value.second));
+      link_right(parent, subtree);
+    }
+    update_path(parent);
+  }
+
+  // Makes the tree hold exactly the nodes of [first, last), given in key
+  // order, with their current weights: the Cartesian tree of the sequence
+  // is built along its right spine in O(n), without comparisons.
+  template <class NodeIt>
+  void assign_sorted(NodeIt first, NodeIt last) {
+    head->left = nullptr;
+    head->succ = head->pred = head;
+    IntrusiveNode<Tag>* prev = head;
+    for (; first != last; ++first) {
+      IntrusiveNode<Tag>* node = *first;
+      IntrusiveNode<Tag>* parent = prev;
+      IntrusiveNode<Tag>* child = nullptr;
+      while (parent != head && parent->weight < node->weight) {
+        child = parent;
+        parent = parent->top;
+      }
+      node->left = node->right = nullptr;
+      link_left(node, child);
+      if (parent == head) {
+        link_left(head, node);
+      } else {
+        link_right(parent, node);
+      }
+      link_after(prev, node);
+      prev = node;
+    }
+    update_subtree(head->left);
+  }
+
+  // Recomputes the aggregates that depend on node after its pair changed
+  // in place; O(depth).
+  void refresh(IntrusiveNode<Tag>* node) {
+    update_path(node);
+  }
+
+  // Combination of the nodes with lo <= key < hi in key order, identity()
+  // if there are none. Only the two search paths of lo and hi are visited:
+  // everything between them is covered by the aggregates of subtrees.
+  template <class A = Augment>
+  typename A::value_type aggregate(const Value& lo, const Value& hi) const {
+    probe from(lo);
+    probe to(hi);
+    auto node = head->left;
+    while (node != nullptr && (less(node, from) || !less(node, to))) {
+      node = less(node, from) ? node->right : node->left;
+    }
+    if (node == nullptr) {
+      return A::identity();
+    }
+    auto result = A::single(node);
+    for (auto cur = node->left; cur != nullptr;) {
+      if (less(cur, from)) {
+        cur = cur->right;
+        continue;
+      }
+      auto taken = A::single(cur);
+      if (cur->right != nullptr) {
+        taken = A::combine(taken, A::subtree(cur->right));
+      }
+      result = A::combine(taken, result);
+      cur = cur->left;
+    }
+    for (auto cur = node->right; cur != nullptr;) {
+      if (!less(cur, to)) {
+        cur = cur->left;
+        continue;
+      }
+      auto taken = A::single(cur);
+      if (cur->left != nullptr) {
+        taken = A::combine(A::subtree(cur->left), taken);
+      }
+      result = A::combine(result, taken);
+      cur = cur->right;
+    }
+    return result;
+  }
+
+  // Moves every node not less than value to other, which must be empty.
+  void split_to(const Value& value, IntrusiveCartesianTree& other) {
+    auto first = const_cast<IntrusiveNode<Tag>*>(lower_bound(value));
+    if (first == head) {
+      return;
+    }
+    auto last = head->pred;
+    auto parts = split(head->left, probe(value));
+    link_left(head, parts.first);
+    head->pred = first->pred;
+    first->pred->succ = head;
+    other.link_left(other.head, parts.second);
+    other.head->succ = first;
+    first->pred = other.head;
+    other.head->pred = last;
+    last->succ = other.head;
+  }
+
+  // Moves every node of other to this tree; all keys of other must be
+  // greater than all keys of this tree.
+  void join(IntrusiveCartesianTree& other) {
+    if (other.head->left == nullptr) {
+      return;
     }
-    return const_cast<IntrusiveNode<Tag>*>(found);
+    auto first = other.head->succ;
+    auto last = other.head->pred;
+    link_left(head, merge(head->left, other.head->left));
+    head->pred->succ = first;
+    first->pred = head->pred;
+    head->pred = last;
+    last->succ = head;
+    other.head->left = nullptr;
+    other.relink_head();
+  }
+
+  // True if value would become the last key, so inserting it can take the
+  // O(1) expected append path of insert_before(end(), ...).
+  bool goes_last(const Value& value) const {
+    return goes_last(probe(value));
+  }
+
+  bool goes_last(const key_probe& key) const {
+    return head->pred == head || less(head->pred, key);
   }
 
   const IntrusiveNode<Tag>* end() const {
@@ -139,38 +549,109 @@ public:
   }
 
   const IntrusiveNode<Tag>* begin() const {
-    return head->left == nullptr ? head : head->left->min();
+    return head->succ;
   }
 
   const Value& get_value(const IntrusiveNode<Tag>* node) const {
-    return dynamic_cast<const NodeBase<Value, Tag>*>(node)->value;
+    return KeyOf()(node);
+  }
+
+  // First node not less than value (Strict = false) or greater than value
+  // (Strict = true), head if there is none. One comparator-only descent.
+  template <bool Strict>
+  const IntrusiveNode<Tag>* bound(const Value& value) const {
+    if (head->left == nullptr) {
+      return head;
+    }
+    return bound_from<Strict>(head->left, probe(value));
   }
 
   const IntrusiveNode<Tag>* lower_bound(const Value& value) const {
-    auto found = find(value);
-    if (found != nullptr) {
-      return found;
+    return bound<false>(value);
+  }
+
+  const IntrusiveNode<Tag>* upper_bound(const Value& value) const {
+    return bound<true>(value);
+  }
+
+  // Finger search: the same queries started from hint instead of the root.
+  // They climb from hint only until its subtree covers value, which takes
+  // O(log d) expected steps for a hint d positions away from the answer.
+  const IntrusiveNode<Tag>* find(const IntrusiveNode<Tag>* hint,
+                                 const Value& value) const {
+    probe key(value);
+    auto found = lower_bound(hint, key);
+    if (found == head || less(key, found)) {
+      return nullptr;
     }
-    auto cur = head->left;
-    while (cur != nullptr && LessComparator::operator()(get_value(cur), value)) {
-      cur = cur->right;
+    return found;
+  }
+
+  const IntrusiveNode<Tag>* lower_bound(const IntrusiveNode<Tag>* hint,
+                                        const Value& value) const {
+    return lower_bound(hint, probe(value));
+  }
+
+  const IntrusiveNode<Tag>* lower_bound(const IntrusiveNode<Tag>* hint,
+                                        const key_probe& key) const {
+    if (hint == head) {
+      hint = head->pred;
+    }
+    if (hint == head) {
+      return head;
     }
-    if (cur == nullptr) {
+    if (less(hint, key) && (hint->succ == head || !less(hint->succ, key))) {
+      return hint->succ;
+    }
+    return bound_from<false>(finger_root(hint, key), key);
+  }
+
+  // Lower bound of value and whether it holds a key equivalent to value:
+  // the node to update or the position to link a new one, in one descent.
+  std::pair<const IntrusiveNode<Tag>*, bool> locate(const Value& value) const {
+    return locate(probe(value));
+  }
+
+  std::pair<const IntrusiveNode<Tag>*, bool>
+  locate(const key_probe& key) const {
+    if (head->left == nullptr) {
+      return {head, false};
+    }
+    auto position = bound_from<false>(head->left, key);
+    return {position, position != head && !less(key, position)};
+  }
+
+  // Where a node with key value would be linked (see insert_before), found
+  // from hint; nullptr if an equivalent key is already present.
+  const IntrusiveNode<Tag>* insert_position(const IntrusiveNode<Tag>* hint,
+                                            const Value& value) const {
+    probe key(value);
+    auto position = lower_bound(hint, key);
+    if (position != head && !less(key, position)) {
       return nullptr;
     }
-    auto cur_lower_bound = cur;
-    cur = cur->left;
-    while (cur != nullptr) {
-      if (LessComparator::operator()(get_value(cur), value)) {
-        cur = cur->right;
-      } else {
-        if (LessComparator::operator()(get_value(cur),
-                                       get_value(cur_lower_bound))) {
-          cur_lower_bound = cur;
-        }
-        cur = cur->left;
-      }
+    return position;
+  }
+
+  // Links node right before position, which must be its lower bound (head
+  // to append). The node goes in as a leaf and is rotated up to restore the
+  // heap order: O(1) expected work beyond finding position.
+  void insert_before(const IntrusiveNode<Tag>* position,
+                     IntrusiveNode<Tag>* node) {
+    auto next = const_cast<IntrusiveNode<Tag>*>(position);
+    node->weight = dist(gen);
+    node->left = node->right = nullptr;
+    if (next != head && next->left == nullptr) {
+      link_left(next, node);
+    } else if (next->pred != head) {
+      link_right(next->pred, node);
+    } else {
+      link_left(head, node);
+    }
+    link_after(next->pred, node);
+    update_path(node);
+    while (node->weight > node->top->weight) {
+      rotate_up(node);
     }
-    return cur_lower_bound;
   }
 };
\ No newline at end of file
@@ -0,0 +1,92 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <type_traits>
+
+// What a node keeps next to its hooks to order keys without reading them.
+// compare returns a negative or positive number if the cached summaries
+// already order the two keys and 0 if the full keys have to be compared.
+// The default caches nothing and never decides.
+template <class Value, class Compare, class = void>
+struct key_cache {
+  key_cache() = default;
+  explicit key_cache(const Value&) {}
+
+  static int compare(const key_cache&, const key_cache&) {
+    return 0;
+  }
+};
+
+// True if the cache has exact = true: compare returning 0 then already
+// means the keys are equivalent and the comparator is never called.
+template <class Cache, class = void>
+struct is_exact_cache : std::false_type {};
+
+template <class Cache>
+struct is_exact_cache<Cache, std::enable_if_t<Cache::exact>>
+    : std::true_type {};
+
+template <class Compare>
+struct is_string_less
+    : std::integral_constant<
+          bool, std::is_same<Compare, std::less<std::string>>::value ||
+                    std::is_same<Compare, std::less<>>::value> {};
+
+// std::string under its natural order: the first 8 bytes as a big-endian
+// integer, zero-padded. Strings order like their prefixes whenever these
+// differ, so most comparisons never touch the heap buffer of the key.
+template <class Compare>
+struct key_cache<std::string, Compare,
+                 std::enable_if_t<is_string_less<Compare>::value>> {
+  std::uint64_t prefix = 0;
+
+  key_cache() = default;
+
+  explicit key_cache(const std::string& key) {
+    std::size_t size = key.size() < 8 ? key.size() : 8;
+    for (std::size_t i = 0; i < 8; i++) {
+      prefix <<= 8;
+      if (i < size) {
+        prefix |= static_cast<unsigned char>(key[i]);
+      }
+    }
+  }
+
+  static int compare(const key_cache& a, const key_cache& b) {
+    return a.prefix < b.prefix ? -1 : a.prefix > b.prefix ? 1 : 0;
+  }
+};
+
+// Orders keys by Compare on Projection()(key). It is the comparator form
+// for orders that are costly to evaluate but reduce to a cheap key, such
+// as a norm or a normalized string. Both types must be default
+// constructible.
+template <class Projection, class Compare = std::less<>>
+struct projected_less {
+  template <class A, class B>
+  bool operator()(const A& a, const B& b) const {
+    return Compare()(Projection()(a), Projection()(b));
+  }
+};
+
+// The projected key itself: a key is projected once when its node is made
+// and once per query, and tree comparisons only compare projections.
+template <class Value, class Projection, class Compare>
+struct key_cache<Value, projected_less<Projection, Compare>> {
+  static constexpr bool exact = true;
+
+  std::decay_t<std::invoke_result_t<Projection, const Value&>> projected{};
+
+  key_cache() = default;
+
+  explicit key_cache(const Value& key) : projected(Projection()(key)) {}
+
+  static int compare(const key_cache& a, const key_cache& b) {
+    Compare less;
+    return less(a.projected, b.projected)   ? -1
+           : less(b.projected, a.projected) ? 1
+                                            : 0;
+  }
+};
@@ -0,0 +1,121 @@
+#pragma once
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct filter_stats {
+  std::size_t keys = 0;
+  std::size_t memory_usage = 0;
+  // Estimated from the share of non-zero counters.
+  double false_positive_rate = 0;
+};
+
+// Blocked counting Bloom filter over the keys of one side of a bimap. A key
+// sets probes counters inside one 64-counter block, so a lookup reads one
+// cache line. Counters are bytes; a counter that reaches 255 stays there,
+// which can only cause false positives, never false negatives. Sized for
+// capacity keys at 8 counters per key; the owner rebuilds it bigger once
+// it holds more.
+template <class Key>
+class key_filter {
+  using hash_fn = std::size_t (*)(const Key&);
+
+  static constexpr std::size_t block_size = 64;
+  static constexpr int probes = 4;
+  static constexpr std::uint8_t saturated = UINT8_MAX;
+
+  struct alignas(64) block {
+    std::uint8_t counters[block_size] = {};
+  };
+
+  hash_fn hash;
+  std::size_t max_keys;
+  std::size_t key_count = 0;
+  std::vector<block> blocks;
+
+  // murmur3 64-bit finalizer: std::hash of integers is often the identity.
+  static std::uint64_t mix(std::uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+  }
+
+  // Calls visit on each counter of key until it returns false.
+  template <class Filter, class Visit>
+  static void probe(Filter& filter, const Key& key, Visit&& visit) {
+    std::uint64_t h = mix(filter.hash(key));
+    auto& b = filter.blocks[(h >> 32) % filter.blocks.size()];
+    for (int i = 0; i < probes; i++) {
+      if (!visit(b.counters[(h >> (6 * i)) % block_size])) {
+        return;
+      }
+    }
+  }
+
+public:
+  key_filter(hash_fn hash, std::size_t capacity)
+      : hash(hash), max_keys(capacity < block_size ? block_size : capacity),
+        blocks((max_keys * 8 + block_size - 1) / block_size) {}
+
+  hash_fn hasher() const {
+    return hash;
+  }
+
+  std::size_t capacity() const {
+    return max_keys;
+  }
+
+  bool full() const {
+    return key_count > max_keys;
+  }
+
+  void add(const Key& key) {
+    key_count++;
+    probe(*this, key, [](std::uint8_t& counter) {
+      if (counter != saturated) {
+        counter++;
+      }
+      return true;
+    });
+  }
+
+  // key must have been added.
+  void remove(const Key& key) {
+    key_count--;
+    probe(*this, key, [](std::uint8_t& counter) {
+      if (counter != saturated) {
+        counter--;
+      }
+      return true;
+    });
+  }
+
+  // False only if key was never added or has been removed.
+  bool may_contain(const Key& key) const {
+    bool found = true;
+    probe(*this, key, [&found](std::uint8_t const& counter) {
+      found = counter != 0;
+      return found;
+    });
+    return found;
+  }
+
+  filter_stats stats() const {
+    std::size_t used = 0;
+    for (auto const& b : blocks) {
+      for (auto counter : b.counters) {
+        used += counter != 0;
+      }
+    }
+    filter_stats result;
+    result.keys = key_count;
+    result.memory_usage = sizeof(*this) + blocks.size() * sizeof(block);
+    result.false_positive_rate =
+        std::pow(double(used) / double(blocks.size() * block_size), probes);
+    return result;
+  }
+};
@@ -0,0 +1,334 @@
+#pragma once
+#include "intrusive_cartesian_tree.h"
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+template <class Node, std::size_t I>
+struct MultiIndexKeyOf {
+  decltype(auto) operator()(const IntrusiveNode<IndexTag<I>>* node) const {
+    return Node::template value_of<I>(node);
+  }
+
+  static decltype(auto) cache(const IntrusiveNode<IndexTag<I>>* node) {
+    return Node::template cache_of<I>(node);
+  }
+};
+
+// Records of several keys, each unique within its own index, e.g.
+//
+//   multi_index<int, std::string, std::string> users;  // id, name, handle
+//   users.insert(1, "Ada", "ada");
+//   auto it = users.find<1>("Ada");
+//   int id = it.get<0>();
+//
+// Each record is one MultiIndexNode holding all keys and one treap hook per
+// index, the node bimap uses with two indexes, so an insert allocates once
+// and no key is stored twice. Insert checks every
+// index before linking, so a record goes into all indexes or none. An
+// iterator of index I projects to the same record in index J with
+// project<J>(), the N-way form of bimap's flip().
+template <class... Keys>
+class multi_index {
+  static_assert(sizeof...(Keys) >= 2, "multi_index needs at least two keys");
+
+  using indices = std::index_sequence_for<Keys...>;
+  using head_t = MultiIndexHead<indices>;
+  using node_t = MultiIndexNode<indices, index_spec<Keys>...>;
+
+  template <std::size_t I>
+  using spec_t = index_spec<std::tuple_element_t<I, std::tuple<Keys...>>>;
+
+  template <std::size_t I>
+  using hook_t = IntrusiveNode<IndexTag<I>>;
+
+public:
+  template <std::size_t I>
+  using key_type = typename spec_t<I>::key_type;
+
+  template <std::size_t I>
+  class iterator;
+
+private:
+  template <std::size_t I>
+  using tree_t =
+      IntrusiveCartesianTree<IndexTag<I>, key_type<I>,
+                             typename spec_t<I>::key_compare,
+                             MultiIndexKeyOf<node_t, I>>;
+
+  template <std::size_t... I>
+  static std::tuple<tree_t<I>...> trees_type(std::index_sequence<I...>);
+
+  head_t head;
+  decltype(trees_type(indices())) trees;
+  std::size_t map_size = 0;
+
+  template <std::size_t... I>
+  explicit multi_index(std::index_sequence<I...>)
+      : trees(static_cast<hook_t<I>*>(&head)...) {}
+
+  template <std::size_t I>
+  tree_t<I>& tree() {
+    return std::get<I>(trees);
+  }
+
+  template <std::size_t I>
+  const tree_t<I>& tree() const {
+    return std::get<I>(trees);
+  }
+
+  template <std::size_t I>
+  static node_t* node_of(const hook_t<I>* hook) {
+    return static_cast<node_t*>(
+        static_cast<head_t*>(const_cast<hook_t<I>*>(hook)));
+  }
+
+  template <std::size_t I>
+  static iterator<I> make_iterator(const hook_t<I>* hook) {
+    return iterator<I>(hook);
+  }
+
+  template <std::size_t... I, class... Args>
+  iterator<0> insert(std::index_sequence<I...>, Args&&... keys) {
+    auto found = std::make_tuple(tree<I>().locate(keys)...);
+    if ((std::get<I>(found).second || ...)) {
+      return end<0>();
+    }
+    auto* node = new node_t(std::forward<Args>(keys)...);
+    (tree<I>().insert_before(std::get<I>(found).first, node), ...);
+    map_size++;
+    return iterator<0>(node);
+  }
+
+  template <std::size_t... I>
+  void erase_node(std::index_sequence<I...>, node_t* node) {
+    (tree<I>().unlink(node), ...);
+    delete node;
+    map_size--;
+  }
+
+  template <std::size_t... I>
+  void relink_heads(std::index_sequence<I...>) {
+    ((tree<I>() = tree_t<I>(&head)), ...);
+  }
+
+  template <std::size_t... I>
+  void swap_comparators(multi_index& other, std::index_sequence<I...>) {
+    (tree<I>().swap_comparator(other.tree<I>()), ...);
+  }
+
+public:
+  template <std::size_t I>
+  class iterator {
+    friend class multi_index;
+
+    const hook_t<I>* node_ptr;
+
+    explicit iterator(const hook_t<I>* node_ptr) : node_ptr(node_ptr) {}
+
+  public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = const key_type<I>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = key_type<I> const*;
+    using reference = key_type<I> const&;
+
+    key_type<I> const& operator*() const {
+      return node_t::template value_of<I>(node_ptr);
+    }
+
+    key_type<I> const* operator->() const {
+      return &(*(*this));
+    }
+
+    iterator& operator++() {
+      node_ptr = node_ptr->next();
+      return *this;
+    }
+
+    iterator operator++(int) {
+      iterator temp = *this;
+      ++*this;
+      return temp;
+    }
+
+    iterator& operator--() {
+      node_ptr = node_ptr->prev();
+      return *this;
+    }
+
+    iterator operator--(int) {
+      iterator temp = *this;
+      --*this;
+      return temp;
+    }
+
+    bool operator==(const iterator& rhs) const {
+      return node_ptr == rhs.node_ptr;
+    }
+
+    bool operator!=(const iterator& rhs) const {
+      return !(*this == rhs);
+    }
+
+    // The same record in index J; end() projects to end().
+    template <std::size_t J>
+    iterator<J> project() const {
+      return make_iterator<J>(
+          static_cast<const hook_t<J>*>(static_cast<const head_t*>(node_ptr)));
+    }
+
+    // Key J of the record.
+    template <std::size_t J>
+    key_type<J> const& get() const {
+      return *project<J>();
+    }
+  };
+
+  multi_index() : multi_index(indices()) {}
+
+  multi_index(multi_index const& other) : multi_index() {
+    for (auto it = other.begin<0>(); it != other.end<0>(); ++it) {
+      std::apply([this](auto const&... keys) { insert(keys...); },
+                 node_of<0>(it.node_ptr)->keys);
+    }
+  }
+
+  multi_index(multi_index&& other) noexcept : multi_index() {
+    swap(other);
+  }
+
+  multi_index& operator=(multi_index const& other) {
+    if (this != &other) {
+      multi_index copy(other);
+      swap(copy);
+    }
+    return *this;
+  }
+
+  multi_index& operator=(multi_index&& other) noexcept {
+    if (this != &other) {
+      clear();
+      swap(other);
+    }
+    return *this;
+  }
+
+  ~multi_index() {
+    clear();
+  }
+
+  void swap(multi_index& other) {
+    std::swap(head, other.head);
+    std::swap(map_size, other.map_size);
+    relink_heads(indices());
+    other.relink_heads(indices());
+    swap_comparators(other, indices());
+  }
+
+  // Adds a record with one key per index, converted from keys. Returns its
+  // iterator in index 0, or end<0>() if any key is already present in its
+  // index, in which case nothing is changed.
+  template <class... Args>
+  iterator<0> insert(Args&&... keys) {
+    static_assert(sizeof...(Args) == sizeof...(Keys),
+                  "insert takes one key per index");
+    return insert(indices(), std::forward<Args>(keys)...);
+  }
+
+  // Removes the record from all indexes; returns the next one in index I.
+  template <std::size_t I>
+  iterator<I> erase(iterator<I> it) {
+    auto next = it;
+    ++next;
+    erase_node(indices(), node_of<I>(it.node_ptr));
+    return next;
+  }
+
+  template <std::size_t I>
+  bool erase(key_type<I> const& key) {
+    auto found = tree<I>().find(key);
+    if (found == nullptr) {
+      return false;
+    }
+    erase_node(indices(), node_of<I>(found));
+    return true;
+  }
+
+  void clear() {
+    while (!empty()) {
+      erase(begin<0>());
+    }
+  }
+
+  template <std::size_t I>
+  iterator<I> find(key_type<I> const& key) const {
+    auto found = tree<I>().find(key);
+    return found == nullptr ? end<I>() : iterator<I>(found);
+  }
+
+  template <std::size_t I>
+  bool contains(key_type<I> const& key) const {
+    return tree<I>().find(key) != nullptr;
+  }
+
+  // Key To of the record whose key From is key; throws std::out_of_range
+  // if there is none.
+  template <std::size_t From, std::size_t To>
+  key_type<To> const& at(key_type<From> const& key) const {
+    auto it = find<From>(key);
+    if (it == end<From>()) {
+      throw std::out_of_range("multi_index::at fail");
+    }
+    return it.template get<To>();
+  }
+
+  template <std::size_t I>
+  iterator<I> lower_bound(key_type<I> const& key) const {
+    return iterator<I>(tree<I>().lower_bound(key));
+  }
+
+  template <std::size_t I>
+  iterator<I> upper_bound(key_type<I> const& key) const {
+    return iterator<I>(tree<I>().upper_bound(key));
+  }
+
+  template <std::size_t I>
+  iterator<I> begin() const {
+    return iterator<I>(tree<I>().begin());
+  }
+
+  template <std::size_t I>
+  iterator<I> end() const {
+    return iterator<I>(tree<I>().end());
+  }
+
+  bool empty() const {
+    return map_size == 0;
+  }
+
+  std::size_t size() const {
+    return map_size;
+  }
+
+  friend bool operator==(multi_index const& a, multi_index const& b) {
+    if (a.size() != b.size()) {
+      return false;
+    }
+    for (auto i = a.tree<0>().begin(), j = b.tree<0>().begin();
+         i != a.tree<0>().end(); i = i->next(), j = j->next()) {
+      if (node_of<0>(i)->keys != node_of<0>(j)->keys) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  friend bool operator!=(multi_index const& a, multi_index const& b) {
+    return !(a == b);
+  }
+};
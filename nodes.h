@@ -1,60 +1,125 @@
 #pragma once
+#include "key_cache.h"
 #include <climits>
+#include <cstddef>
+#include <functional>
+#include <tuple>
+#include <utility>
 
 template <class Tag>
 struct IntrusiveNode {
   IntrusiveNode<Tag>* left = nullptr;
   IntrusiveNode<Tag>* right = nullptr;
   IntrusiveNode<Tag>* top = nullptr;
+  // In-order threads: the sentinel head closes them into a ring, so
+  // iteration and begin()/end() never walk the tree. They cost two
+  // pointers per hook, 32 bytes per bimap pair on 64-bit, and are always
+  // on because appends, finger searches and joins read them too. See
+  // threaded_scans() in benchmarks.cpp for the size and scan numbers.
+  IntrusiveNode<Tag>* succ = nullptr;
+  IntrusiveNode<Tag>* pred = nullptr;
   int weight;
   IntrusiveNode() {}
 
-  virtual ~IntrusiveNode() = default;
-
   const IntrusiveNode<Tag>* next() const {
-    if (this->right != nullptr) {
-      return this->right->min();
-    } else {
-      auto cur = this;
-      while (cur->top != nullptr && cur->top->left != cur) {
-        cur = cur->top;
-      }
-      return cur->top;
-    }
+    return succ;
   }
 
   const IntrusiveNode<Tag>* prev() const {
-    if (this->left != nullptr) {
-      return this->left->max();
-    } else {
-      auto cur = this;
-      while (cur->top != nullptr && cur->top->right != cur) {
-        cur = cur->top;
-      }
-      return cur->top;
-    }
+    return pred;
+  }
+};
+
+// The key_cache of one index, tagged so that equal cache types of several
+// indexes stay distinct bases.
+template <class Tag, class Cache>
+struct NodeCache : public Cache {
+  NodeCache() = default;
+  template <class Value>
+  explicit NodeCache(const Value& value) : Cache(value) {}
+};
+
+// Tag of the I-th index of a node; bimap's LeftTag and RightTag are
+// IndexTag<0> and IndexTag<1>.
+template <std::size_t I>
+struct IndexTag {};
+
+// Key type and comparator of one index; a plain type T stands for
+// unique_key<T>.
+template <class Key, class Compare = std::less<Key>>
+struct unique_key {
+  using key_type = Key;
+  using key_compare = Compare;
+};
+
+template <class T>
+struct index_spec : unique_key<T> {};
+
+template <class Key, class Compare>
+struct index_spec<unique_key<Key, Compare>> : unique_key<Key, Compare> {};
+
+template <class Indices>
+struct MultiIndexHead;
+
+template <std::size_t... I>
+struct MultiIndexHead<std::index_sequence<I...>>
+    : public IntrusiveNode<IndexTag<I>>... {};
+
+// A node of several indexes: one hook per index, then the key caches and
+// then the keys, all in one block without a vptr. Any hook converts to any
+// other through the head, which is how iterators flip or project between
+// indexes. bimap's Node is the case of two indexes; multi_index uses it
+// for any number.
+template <class Indices, class... Specs>
+struct MultiIndexNode;
+
+template <std::size_t... I, class... Specs>
+struct MultiIndexNode<std::index_sequence<I...>, Specs...>
+    : public MultiIndexHead<std::index_sequence<I...>>,
+      public NodeCache<IndexTag<I>, key_cache<typename Specs::key_type,
+                                              typename Specs::key_compare>>... {
+  using head_t = MultiIndexHead<std::index_sequence<I...>>;
+
+  template <std::size_t J>
+  using spec_t = std::tuple_element_t<J, std::tuple<Specs...>>;
+
+  template <std::size_t J>
+  using key_t = typename spec_t<J>::key_type;
+
+  template <std::size_t J>
+  using cache_t = key_cache<key_t<J>, typename spec_t<J>::key_compare>;
+
+  std::tuple<typename Specs::key_type...> keys;
+
+  template <class... Args>
+  explicit MultiIndexNode(Args&&... args)
+      : head_t(), keys(std::forward<Args>(args)...) {
+    ((static_cast<NodeCache<IndexTag<I>, cache_t<I>>&>(*this) =
+          NodeCache<IndexTag<I>, cache_t<I>>(std::get<I>(keys))),
+     ...);
   }
 
-  const IntrusiveNode<Tag>* min() const {
-    if (this->left == nullptr) {
-      return this;
-    }
-    return this->left->min();
+  // Replaces key J; the node must be unlinked from index J or relinked
+  // before the next search in it.
+  template <std::size_t J, class Arg>
+  void assign(IndexTag<J>, Arg&& key) {
+    std::get<J>(keys) = std::forward<Arg>(key);
+    static_cast<NodeCache<IndexTag<J>, cache_t<J>>&>(*this) =
+        NodeCache<IndexTag<J>, cache_t<J>>(std::get<J>(keys));
   }
 
-  const IntrusiveNode<Tag>* max() const {
-    if (this->right == nullptr) {
-      return this;
-    }
-    return this->right->max();
+  static const MultiIndexNode* of(const head_t* head) {
+    return static_cast<const MultiIndexNode*>(head);
   }
-};
 
-template <class Type, class Tag>
-struct NodeBase : public IntrusiveNode<Tag> {
-  Type value;
+  template <std::size_t J>
+  static const key_t<J>& value_of(const IntrusiveNode<IndexTag<J>>* node) {
+    return std::get<J>(of(static_cast<const head_t*>(node))->keys);
+  }
 
-  template <class ValueType = Type>
-  NodeBase(ValueType&& value)
-      : IntrusiveNode<Tag>(), value(std::forward<ValueType>(value)) {}
+  template <std::size_t J>
+  static const cache_t<J>& cache_of(const IntrusiveNode<IndexTag<J>>* node) {
+    return static_cast<const NodeCache<IndexTag<J>, cache_t<J>>&>(
+        *of(static_cast<const head_t*>(node)));
+  }
 };
@@ -0,0 +1,226 @@
+#pragma once
+#include "bimap.h"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <stdexcept>
+#include <utility>
+
+// Thread-safe bimap split into N shards. A pair is indexed by the left tree
+// of the shard its left key hashes to and by the right tree of the shard its
+// right key hashes to, so every operation locks at most these two shards.
+// Lookups take shared locks and return copies of the paired value.
+template <typename Left, typename Right, std::size_t N = 16,
+          typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>,
+          typename HashLeft = std::hash<Left>,
+          typename HashRight = std::hash<Right>>
+class sharded_bimap {
+  static_assert(N > 0, "sharded_bimap needs at least one shard");
+
+  using left_t = Left;
+  using right_t = Right;
+  using node_t = Node<left_t, right_t, CompareLeft, CompareRight>;
+  using left_tree_t = IntrusiveCartesianTree<LeftTag, left_t, CompareLeft,
+                                             NodeKeyOf<node_t, LeftTag>>;
+  using right_tree_t = IntrusiveCartesianTree<RightTag, right_t, CompareRight,
+                                              NodeKeyOf<node_t, RightTag>>;
+  using exclusive_lock = std::unique_lock<std::shared_mutex>;
+  using shared_lock = std::shared_lock<std::shared_mutex>;
+
+  struct shard {
+    mutable std::shared_mutex mutex;
+    NodeHead head;
+    left_tree_t left_set;
+    right_tree_t right_set;
+
+    shard() : left_set(&head), right_set(&head) {}
+  };
+
+  // Locks the shards of both sides of a pair exclusively, each one once.
+  struct pair_lock {
+    exclusive_lock first;
+    exclusive_lock second;
+
+    pair_lock(shard& a, shard& b)
+        : first(a.mutex, std::defer_lock), second(b.mutex, std::defer_lock) {
+      if (&a == &b) {
+        first.lock();
+      } else {
+        std::lock(first, second);
+      }
+    }
+  };
+
+  std::array<shard, N> shards;
+  std::atomic<std::size_t> map_size{0};
+  HashLeft hash_left;
+  HashRight hash_right;
+
+  static node_t* node_of(const IntrusiveNode<LeftTag>* node) {
+    return const_cast<node_t*>(
+        static_cast<const node_t*>(static_cast<const NodeHead*>(node)));
+  }
+
+  static node_t* node_of(const IntrusiveNode<RightTag>* node) {
+    return const_cast<node_t*>(
+        static_cast<const node_t*>(static_cast<const NodeHead*>(node)));
+  }
+
+  template <class Tree, class Key>
+  static node_t* find_node(Tree const& tree, Key const& key) {
+    auto found = tree.find(key);
+    return found == nullptr ? nullptr : node_of(found);
+  }
+
+  shard& left_shard(left_t const& left) {
+    return shards[hash_left(left) % N];
+  }
+
+  const shard& left_shard(left_t const& left) const {
+    return shards[hash_left(left) % N];
+  }
+
+  shard& right_shard(right_t const& right) {
+    return shards[hash_right(right) % N];
+  }
+
+  const shard& right_shard(right_t const& right) const {
+    return shards[hash_right(right) % N];
+  }
+
+  // Finds the node by one side, then locks both of its shards and checks
+  // that the pair did not change in between.
+  template <class FindOwn, class OtherShard>
+  bool erase_by(shard& own, FindOwn find_own, OtherShard other_shard) {
+    while (true) {
+      shard* other;
+      {
+        shared_lock lock(own.mutex);
+        auto node = find_own();
+        if (node == nullptr) {
+          return false;
+        }
+        other = &other_shard(node);
+      }
+      pair_lock lock(own, *other);
+      auto node = find_own();
+      if (node == nullptr) {
+        return false;
+      }
+      if (&other_shard(node) != other) {
+        continue;
+      }
+      left_shard(node->left_value()).left_set.unlink(node);
+      right_shard(node->right_value()).right_set.unlink(node);
+      delete node;
+      map_size--;
+      return true;
+    }
+  }
+
+public:
+  sharded_bimap() = default;
+  sharded_bimap(sharded_bimap const&) = delete;
+  sharded_bimap& operator=(sharded_bimap const&) = delete;
+
+  ~sharded_bimap() {
+    for (auto& s : shards) {
+      auto cur = s.left_set.begin();
+      while (cur != s.left_set.end()) {
+        auto node = node_of(cur);
+        cur = cur->next();
+        delete node;
+      }
+    }
+  }
+
+  // Inserts the pair unless its left or its right key is already present.
+  // Both checks and the linking happen under the locks of both shards, so
+  // concurrent inserts never create duplicates on either side.
+  template <class LeftArg = left_t, class RightArg = right_t>
+  bool insert(LeftArg&& left, RightArg&& right) {
+    auto* node = new node_t(std::forward<LeftArg>(left),
+                            std::forward<RightArg>(right));
+    shard& ls = left_shard(node->left_value());
+    shard& rs = right_shard(node->right_value());
+    {
+      pair_lock lock(ls, rs);
+      if (ls.left_set.find(node->left_value()) == nullptr &&
+          rs.right_set.find(node->right_value()) == nullptr) {
+        ls.left_set.insert(node);
+        rs.right_set.insert(node);
+        map_size++;
+        return true;
+      }
+    }
+    delete node;
+    return false;
+  }
+
+  bool erase_left(left_t const& left) {
+    shard& ls = left_shard(left);
+    return erase_by(
+        ls, [&] { return find_node(ls.left_set, left); },
+        [&](node_t* node) -> shard& {
+          return right_shard(node->right_value());
+        });
+  }
+
+  bool erase_right(right_t const& right) {
+    shard& rs = right_shard(right);
+    return erase_by(
+        rs, [&] { return find_node(rs.right_set, right); },
+        [&](node_t* node) -> shard& {
+          return left_shard(node->left_value());
+        });
+  }
+
+  std::optional<right_t> find_left(left_t const& left) const {
+    const shard& ls = left_shard(left);
+    shared_lock lock(ls.mutex);
+    auto found = ls.left_set.find(left);
+    if (found == nullptr) {
+      return std::nullopt;
+    }
+    return node_of(found)->right_value();
+  }
+
+  std::optional<left_t> find_right(right_t const& right) const {
+    const shard& rs = right_shard(right);
+    shared_lock lock(rs.mutex);
+    auto found = rs.right_set.find(right);
+    if (found == nullptr) {
+      return std::nullopt;
+    }
+    return node_of(found)->left_value();
+  }
+
+  right_t at_left(left_t const& key) const {
+    auto found = find_left(key);
+    if (!found) {
+      throw std::out_of_range("at_left fail");
+    }
+    return std::move(*found);
+  }
+
+  left_t at_right(right_t const& key) const {
+    auto found = find_right(key);
+    if (!found) {
+      throw std::out_of_range("at_right fail");
+    }
+    return std::move(*found);
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  std::size_t size() const {
+    return map_size.load();
+  }
+};
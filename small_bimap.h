@@ -0,0 +1,658 @@
+#pragma once
+#include "bimap.h"
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+// bimap for maps that usually stay tiny: up to N pairs live in slots inside
+// the object, ordered by each side through a sorted array of slot numbers,
+// so such a map makes no allocations at all. Inserting the N + 1-st pair
+// moves every pair into a heap-allocated bimap, which then serves all
+// operations for the rest of the life of the map. That switch invalidates
+// all iterators; otherwise iterators, flip() and bounds behave as in bimap.
+template <typename Left, typename Right, std::size_t N = 16,
+          typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>>
+class small_bimap {
+  static_assert(N > 0 && N < 256, "small_bimap holds 1 to 255 inline pairs");
+
+  using left_t = Left;
+  using right_t = Right;
+  using slot_t = unsigned char;
+  using big_t = bimap<Left, Right, CompareLeft, CompareRight>;
+  using big_left_iterator = decltype(std::declval<big_t&>().end_left());
+  using big_right_iterator = decltype(std::declval<big_t&>().end_right());
+
+  // Slot number of end iterators in inline mode.
+  static constexpr slot_t none = N;
+  static constexpr int left_side = 0;
+  static constexpr int right_side = 1;
+
+  struct Slot {
+    union {
+      Left left_value;
+    };
+    union {
+      Right right_value;
+    };
+
+    Slot() {}
+    ~Slot() {}
+  };
+
+  template <class Compare, int Side>
+  struct compare_holder : Compare {
+    compare_holder(Compare compare) : Compare(std::move(compare)) {}
+  };
+
+  using left_compare = compare_holder<CompareLeft, left_side>;
+  using right_compare = compare_holder<CompareRight, right_side>;
+
+  struct state : left_compare, right_compare {
+    state(CompareLeft compare_left, CompareRight compare_right)
+        : left_compare(std::move(compare_left)),
+          right_compare(std::move(compare_right)) {}
+
+    Slot slots[N];
+    bool live[N] = {};
+    slot_t order[2][N]; // [side][position] - slot
+    slot_t rank[2][N];  // [side][slot] - position
+    slot_t count = 0;
+    std::unique_ptr<big_t> big;
+  };
+
+  state st;
+
+  template <int Side>
+  const auto& value(slot_t i) const {
+    if constexpr (Side == left_side) {
+      return st.slots[i].left_value;
+    } else {
+      return st.slots[i].right_value;
+    }
+  }
+
+  template <int Side, class A, class B>
+  bool less(A const& a, B const& b) const {
+    if constexpr (Side == left_side) {
+      return static_cast<left_compare const&>(st)(a, b);
+    } else {
+      return static_cast<right_compare const&>(st)(a, b);
+    }
+  }
+
+  // Position in order[Side] of the first key not less than key (Strict =
+  // false) or greater than key (Strict = true).
+  template <int Side, bool Strict, class Key>
+  slot_t bound_position(Key const& key) const {
+    slot_t lo = 0;
+    slot_t hi = st.count;
+    while (lo < hi) {
+      slot_t mid = (lo + hi) / 2;
+      const auto& mid_value = value<Side>(st.order[Side][mid]);
+      if (Strict ? !less<Side>(key, mid_value) : less<Side>(mid_value, key)) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return lo;
+  }
+
+  template <int Side>
+  slot_t at_position(slot_t position) const {
+    return position < st.count ? st.order[Side][position] : none;
+  }
+
+  template <int Side, bool Strict, class Key>
+  slot_t bound(Key const& key) const {
+    return at_position<Side>(bound_position<Side, Strict>(key));
+  }
+
+  template <int Side, class Key>
+  slot_t find(Key const& key) const {
+    slot_t i = bound<Side, false>(key);
+    if (i != none && less<Side>(key, value<Side>(i))) {
+      return none;
+    }
+    return i;
+  }
+
+  // Neighbour of slot i in the order of Side: the next one for Dir = 1, the
+  // previous one for Dir = 0. none stands for the end.
+  template <int Side, int Dir>
+  slot_t step(slot_t i) const {
+    slot_t position = i == none ? st.count : st.rank[Side][i];
+    return at_position<Side>(Dir == 1 ? position + 1 : position - 1);
+  }
+
+  template <int Side>
+  void renumber(slot_t from) {
+    for (slot_t p = from; p < st.count; p++) {
+      st.rank[Side][st.order[Side][p]] = p;
+    }
+  }
+
+  template <int Side>
+  void link(slot_t i, slot_t position) {
+    for (slot_t p = st.count; p > position; p--) {
+      st.order[Side][p] = st.order[Side][p - 1];
+    }
+    st.order[Side][position] = i;
+  }
+
+  template <int Side>
+  void unlink(slot_t i) {
+    for (slot_t p = st.rank[Side][i]; p + 1 < st.count; p++) {
+      st.order[Side][p] = st.order[Side][p + 1];
+    }
+  }
+
+  void destroy_values(slot_t i) {
+    st.slots[i].left_value.~Left();
+    st.slots[i].right_value.~Right();
+  }
+
+  void destroy(slot_t i) {
+    destroy_values(i);
+    st.live[i] = false;
+  }
+
+  void erase_slot(slot_t i) {
+    slot_t left_position = st.rank[left_side][i];
+    slot_t right_position = st.rank[right_side][i];
+    unlink<left_side>(i);
+    unlink<right_side>(i);
+    destroy(i);
+    st.count--;
+    renumber<left_side>(left_position);
+    renumber<right_side>(right_position);
+  }
+
+  // Moves every inline pair into a new bimap, in increasing left order so
+  // that each insertion takes its append path. Pairs are copied unless
+  // both moves cannot throw, so a throwing insert leaves the inline map
+  // intact; when they are moved, the pairs already in the bimap are moved
+  // back if a later insert throws.
+  void spill() {
+    auto big = std::make_unique<big_t>(static_cast<left_compare const&>(st),
+                                       static_cast<right_compare const&>(st));
+    if constexpr (std::is_nothrow_move_constructible<Left>::value &&
+                  std::is_nothrow_move_constructible<Right>::value) {
+      try {
+        for (slot_t p = 0; p < st.count; p++) {
+          Slot& slot = st.slots[st.order[left_side][p]];
+          big->insert(std::move(slot.left_value), std::move(slot.right_value));
+        }
+      } catch (...) {
+        // The bimap holds the first pairs in left order and is about to be
+        // destroyed, so its keys may be moved from.
+        slot_t p = 0;
+        for (auto it = big->begin_left(); it != big->end_left(); ++it, ++p) {
+          slot_t i = st.order[left_side][p];
+          destroy_values(i);
+          new (&st.slots[i].left_value)
+              Left(std::move(const_cast<Left&>(*it)));
+          new (&st.slots[i].right_value)
+              Right(std::move(const_cast<Right&>(*it.flip())));
+        }
+        throw;
+      }
+    } else {
+      for (slot_t p = 0; p < st.count; p++) {
+        Slot& slot = st.slots[st.order[left_side][p]];
+        big->insert(static_cast<Left const&>(slot.left_value),
+                    static_cast<Right const&>(slot.right_value));
+      }
+    }
+    clear_inline();
+    st.big = std::move(big);
+  }
+
+  void clear_inline() {
+    for (slot_t i = 0; i < N; i++) {
+      if (st.live[i]) {
+        destroy(i);
+      }
+    }
+    st.count = 0;
+  }
+
+  void copy_links(small_bimap const& other) {
+    for (int side : {left_side, right_side}) {
+      for (slot_t p = 0; p < other.st.count; p++) {
+        st.order[side][p] = other.st.order[side][p];
+        st.rank[side][st.order[side][p]] = p;
+      }
+    }
+    st.count = other.st.count;
+  }
+
+  // Moves the pairs of other, which is left empty, into this empty map.
+  void take(small_bimap& other) {
+    if (other.st.big) {
+      st.big = std::move(other.st.big);
+      return;
+    }
+    for (slot_t i = 0; i < N; i++) {
+      if (other.st.live[i]) {
+        new (&st.slots[i].left_value)
+            Left(std::move(other.st.slots[i].left_value));
+        new (&st.slots[i].right_value)
+            Right(std::move(other.st.slots[i].right_value));
+        st.live[i] = true;
+      }
+    }
+    copy_links(other);
+    other.clear_inline();
+  }
+
+  template <int Side, class Value, class Derived, class BigIterator>
+  class base_iterator {
+  protected:
+    const small_bimap* map;
+    std::variant<slot_t, BigIterator> pos;
+    base_iterator(const small_bimap* map, slot_t slot)
+        : map(map), pos(slot) {}
+    base_iterator(const small_bimap* map, BigIterator it)
+        : map(map), pos(it) {}
+
+  public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = const Value;
+    using difference_type = std::ptrdiff_t;
+    using pointer = Value const*;
+    using reference = Value const&;
+
+    Value const& operator*() const {
+      if (auto slot = std::get_if<slot_t>(&pos)) {
+        return map->template value<Side>(*slot);
+      }
+      return *std::get<BigIterator>(pos);
+    }
+
+    Value const* operator->() const {
+      return &(*(*this));
+    }
+
+    Derived& operator++() {
+      if (auto slot = std::get_if<slot_t>(&pos)) {
+        *slot = map->template step<Side, 1>(*slot);
+      } else {
+        ++std::get<BigIterator>(pos);
+      }
+      return static_cast<Derived&>(*this);
+    }
+
+    Derived operator++(int) {
+      Derived temp = static_cast<Derived&>(*this);
+      ++*this;
+      return temp;
+    }
+
+    Derived& operator--() {
+      if (auto slot = std::get_if<slot_t>(&pos)) {
+        *slot = map->template step<Side, 0>(*slot);
+      } else {
+        --std::get<BigIterator>(pos);
+      }
+      return static_cast<Derived&>(*this);
+    }
+
+    Derived operator--(int) {
+      Derived temp = static_cast<Derived&>(*this);
+      --*this;
+      return temp;
+    }
+
+    bool operator==(const base_iterator& rhs) const {
+      return pos == rhs.pos;
+    }
+
+    bool operator!=(const base_iterator& rhs) const {
+      return !(*this == rhs);
+    }
+  };
+
+  class right_iterator;
+
+  class left_iterator : public base_iterator<left_side, Left, left_iterator,
+                                             big_left_iterator> {
+    friend class small_bimap;
+    using base = base_iterator<left_side, Left, left_iterator,
+                               big_left_iterator>;
+    using base::base;
+
+  public:
+    right_iterator flip() const {
+      if (auto slot = std::get_if<slot_t>(&this->pos)) {
+        return right_iterator(this->map, *slot);
+      }
+      return right_iterator(this->map,
+                            big_left_iterator(std::get<1>(this->pos)).flip());
+    }
+  };
+
+  class right_iterator : public base_iterator<right_side, Right, right_iterator,
+                                              big_right_iterator> {
+    friend class small_bimap;
+    using base = base_iterator<right_side, Right, right_iterator,
+                               big_right_iterator>;
+    using base::base;
+
+  public:
+    left_iterator flip() const {
+      if (auto slot = std::get_if<slot_t>(&this->pos)) {
+        return left_iterator(this->map, *slot);
+      }
+      return left_iterator(this->map,
+                           big_right_iterator(std::get<1>(this->pos)).flip());
+    }
+  };
+
+  left_iterator left_at(slot_t i) const {
+    return left_iterator(this, i);
+  }
+
+  right_iterator right_at(slot_t i) const {
+    return right_iterator(this, i);
+  }
+
+  static big_left_iterator big_of(left_iterator it) {
+    return std::get<big_left_iterator>(it.pos);
+  }
+
+  static big_right_iterator big_of(right_iterator it) {
+    return std::get<big_right_iterator>(it.pos);
+  }
+
+public:
+  small_bimap(CompareLeft compare_left = CompareLeft(),
+              CompareRight compare_right = CompareRight())
+      : st(std::move(compare_left), std::move(compare_right)) {}
+
+  // Inline pairs keep their slot numbers in the copy.
+  small_bimap(small_bimap const& other)
+      : st(static_cast<left_compare const&>(other.st),
+           static_cast<right_compare const&>(other.st)) {
+    if (other.st.big) {
+      st.big = std::make_unique<big_t>(*other.st.big);
+      return;
+    }
+    for (slot_t i = 0; i < N; i++) {
+      if (other.st.live[i]) {
+        try {
+          new (&st.slots[i].left_value) Left(other.st.slots[i].left_value);
+          try {
+            new (&st.slots[i].right_value) Right(other.st.slots[i].right_value);
+          } catch (...) {
+            st.slots[i].left_value.~Left();
+            throw;
+          }
+        } catch (...) {
+          clear_inline();
+          throw;
+        }
+        st.live[i] = true;
+      }
+    }
+    copy_links(other);
+  }
+
+  small_bimap(small_bimap&& other)
+      : st(static_cast<left_compare const&>(other.st),
+           static_cast<right_compare const&>(other.st)) {
+    take(other);
+  }
+
+  small_bimap& operator=(small_bimap const& other) {
+    if (this != &other) {
+      small_bimap(other).swap(*this);
+    }
+    return *this;
+  }
+
+  small_bimap& operator=(small_bimap&& other) {
+    if (this != &other) {
+      clear_inline();
+      st.big.reset();
+      static_cast<left_compare&>(st) = static_cast<left_compare&>(other.st);
+      static_cast<right_compare&>(st) = static_cast<right_compare&>(other.st);
+      take(other);
+    }
+    return *this;
+  }
+
+  ~small_bimap() {
+    clear_inline();
+  }
+
+  // Inline pairs cannot be exchanged by pointers, so unless both maps are
+  // in big mode this moves the pairs of both maps.
+  void swap(small_bimap& other) {
+    if (st.big && other.st.big) {
+      std::swap(static_cast<left_compare&>(st),
+                static_cast<left_compare&>(other.st));
+      std::swap(static_cast<right_compare&>(st),
+                static_cast<right_compare&>(other.st));
+      st.big.swap(other.st.big);
+      return;
+    }
+    small_bimap temp(std::move(other));
+    other = std::move(*this);
+    *this = std::move(temp);
+  }
+
+  // False once the pairs have moved to the heap-allocated bimap.
+  bool is_inline() const {
+    return st.big == nullptr;
+  }
+
+  template <class LeftArg = left_t, class RightArg = right_t>
+  left_iterator insert(LeftArg&& left, RightArg&& right) {
+    if (st.big) {
+      return left_iterator(this, st.big->insert(std::forward<LeftArg>(left),
+                                                std::forward<RightArg>(right)));
+    }
+    slot_t left_position = bound_position<left_side, false>(left);
+    slot_t right_position = bound_position<right_side, false>(right);
+    if ((left_position < st.count &&
+         !less<left_side>(left, value<left_side>(
+                                    st.order[left_side][left_position]))) ||
+        (right_position < st.count &&
+         !less<right_side>(right, value<right_side>(
+                                      st.order[right_side][right_position])))) {
+      return end_left();
+    }
+    if (st.count == N) {
+      spill();
+      return insert(std::forward<LeftArg>(left), std::forward<RightArg>(right));
+    }
+    slot_t i = 0;
+    while (st.live[i]) {
+      i++;
+    }
+    new (&st.slots[i].left_value) Left(std::forward<LeftArg>(left));
+    try {
+      new (&st.slots[i].right_value) Right(std::forward<RightArg>(right));
+    } catch (...) {
+      st.slots[i].left_value.~Left();
+      throw;
+    }
+    st.live[i] = true;
+    link<left_side>(i, left_position);
+    link<right_side>(i, right_position);
+    st.count++;
+    renumber<left_side>(left_position);
+    renumber<right_side>(right_position);
+    return left_at(i);
+  }
+
+  left_iterator erase_left(left_iterator it) {
+    if (st.big) {
+      return left_iterator(this, st.big->erase_left(big_of(it)));
+    }
+    auto next = std::next(it);
+    erase_slot(std::get<slot_t>(it.pos));
+    return next;
+  }
+
+  bool erase_left(left_t const& left) {
+    auto it = find_left(left);
+    if (it == end_left()) {
+      return false;
+    }
+    erase_left(it);
+    return true;
+  }
+
+  right_iterator erase_right(right_iterator it) {
+    if (st.big) {
+      return right_iterator(this, st.big->erase_right(big_of(it)));
+    }
+    auto next = std::next(it);
+    erase_slot(std::get<slot_t>(it.pos));
+    return next;
+  }
+
+  bool erase_right(right_t const& right) {
+    auto it = find_right(right);
+    if (it == end_right()) {
+      return false;
+    }
+    erase_right(it);
+    return true;
+  }
+
+  left_iterator erase_left(left_iterator first, left_iterator last) {
+    while (first != last) {
+      first = erase_left(first);
+    }
+    return last;
+  }
+
+  right_iterator erase_right(right_iterator first, right_iterator last) {
+    while (first != last) {
+      first = erase_right(first);
+    }
+    return last;
+  }
+
+  left_iterator find_left(left_t const& left) const {
+    if (st.big) {
+      return left_iterator(this, st.big->find_left(left));
+    }
+    return left_at(find<left_side>(left));
+  }
+
+  right_iterator find_right(right_t const& right) const {
+    if (st.big) {
+      return right_iterator(this, st.big->find_right(right));
+    }
+    return right_at(find<right_side>(right));
+  }
+
+  right_t const& at_left(left_t const& key) const {
+    auto it = find_left(key);
+    if (it == end_left()) {
+      throw std::out_of_range("at_left fail");
+    }
+    return *it.flip();
+  }
+
+  left_t const& at_right(right_t const& key) const {
+    auto it = find_right(key);
+    if (it == end_right()) {
+      throw std::out_of_range("at_right fail");
+    }
+    return *it.flip();
+  }
+
+  left_iterator lower_bound_left(const left_t& left) const {
+    if (st.big) {
+      return left_iterator(this, st.big->lower_bound_left(left));
+    }
+    return left_at(bound<left_side, false>(left));
+  }
+
+  left_iterator upper_bound_left(const left_t& left) const {
+    if (st.big) {
+      return left_iterator(this, st.big->upper_bound_left(left));
+    }
+    return left_at(bound<left_side, true>(left));
+  }
+
+  right_iterator lower_bound_right(const right_t& right) const {
+    if (st.big) {
+      return right_iterator(this, st.big->lower_bound_right(right));
+    }
+    return right_at(bound<right_side, false>(right));
+  }
+
+  right_iterator upper_bound_right(const right_t& right) const {
+    if (st.big) {
+      return right_iterator(this, st.big->upper_bound_right(right));
+    }
+    return right_at(bound<right_side, true>(right));
+  }
+
+  left_iterator begin_left() const {
+    if (st.big) {
+      return left_iterator(this, st.big->begin_left());
+    }
+    return left_at(at_position<left_side>(0));
+  }
+
+  left_iterator end_left() const {
+    if (st.big) {
+      return left_iterator(this, st.big->end_left());
+    }
+    return left_at(none);
+  }
+
+  right_iterator begin_right() const {
+    if (st.big) {
+      return right_iterator(this, st.big->begin_right());
+    }
+    return right_at(at_position<right_side>(0));
+  }
+
+  right_iterator end_right() const {
+    if (st.big) {
+      return right_iterator(this, st.big->end_right());
+    }
+    return right_at(none);
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  std::size_t size() const {
+    return st.big ? st.big->size() : st.count;
+  }
+
+  friend bool operator==(small_bimap const& a, small_bimap const& b) {
+    if (a.size() != b.size()) {
+      return false;
+    }
+    for (auto ita = a.begin_left(), itb = b.begin_left(); ita != a.end_left();
+         ++ita, ++itb) {
+      if (*ita != *itb || *ita.flip() != *itb.flip()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  friend bool operator!=(small_bimap const& a, small_bimap const& b) {
+    return !(a == b);
+  }
+
+};
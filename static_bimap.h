@@ -0,0 +1,324 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+
+// Immutable bimap of N pairs built from a braced list, meant for lookup
+// tables: with literal key types and constexpr comparators it is built at
+// compile time, lives in read-only data and needs no initialization at
+// startup. Pairs are stored sorted by left key, and an index array orders
+// them by right key, so all queries are binary searches.
+//
+//   constexpr auto colors = make_static_bimap<int, std::string_view>(
+//       {{1, "red"}, {2, "green"}});
+//
+// A key repeated on either side throws std::invalid_argument, which is a
+// compile error when the table is constexpr.
+template <typename Left, typename Right, std::size_t N,
+          typename CompareLeft = std::less<Left>,
+          typename CompareRight = std::less<Right>>
+class static_bimap {
+  static_assert(N > 0, "static_bimap needs at least one pair");
+
+  using left_t = Left;
+  using right_t = Right;
+  static constexpr int left_side = 0;
+  static constexpr int right_side = 1;
+
+  template <class Compare, int Side>
+  struct compare_holder : Compare {
+    constexpr compare_holder(Compare compare) : Compare(std::move(compare)) {}
+  };
+
+  using left_compare = compare_holder<CompareLeft, left_side>;
+  using right_compare = compare_holder<CompareRight, right_side>;
+
+  struct state : left_compare, right_compare {
+    constexpr state(CompareLeft compare_left, CompareRight compare_right)
+        : left_compare(std::move(compare_left)),
+          right_compare(std::move(compare_right)) {}
+
+    Left left_values[N]{};        // sorted by left key
+    Right right_values[N]{};      // paired with left_values
+    std::size_t right_order[N]{}; // [position by right] - position by left
+    std::size_t right_rank[N]{};  // [position by left] - position by right
+  };
+
+  state st;
+
+  template <class T>
+  static constexpr void exchange(T& a, T& b) {
+    T temp = a;
+    a = b;
+    b = temp;
+  }
+
+  // Value at the given position in the order of Side.
+  template <int Side>
+  constexpr const auto& value(std::size_t position) const {
+    if constexpr (Side == left_side) {
+      return st.left_values[position];
+    } else {
+      return st.right_values[st.right_order[position]];
+    }
+  }
+
+  template <int Side, class A, class B>
+  constexpr bool less(A const& a, B const& b) const {
+    if constexpr (Side == left_side) {
+      return static_cast<left_compare const&>(st)(a, b);
+    } else {
+      return static_cast<right_compare const&>(st)(a, b);
+    }
+  }
+
+  // Insertion sort: tables are small and it runs in constant evaluation.
+  constexpr void sort() {
+    for (std::size_t i = 1; i < N; i++) {
+      for (std::size_t j = i;
+           j > 0 && less<left_side>(st.left_values[j], st.left_values[j - 1]);
+           j--) {
+        exchange(st.left_values[j], st.left_values[j - 1]);
+        exchange(st.right_values[j], st.right_values[j - 1]);
+      }
+    }
+    for (std::size_t i = 0; i < N; i++) {
+      st.right_order[i] = i;
+    }
+    for (std::size_t i = 1; i < N; i++) {
+      for (std::size_t j = i;
+           j > 0 &&
+           less<right_side>(value<right_side>(j), value<right_side>(j - 1));
+           j--) {
+        exchange(st.right_order[j], st.right_order[j - 1]);
+      }
+    }
+    for (std::size_t i = 0; i < N; i++) {
+      st.right_rank[st.right_order[i]] = i;
+    }
+  }
+
+  template <int Side>
+  constexpr void check_unique() const {
+    for (std::size_t i = 1; i < N; i++) {
+      if (!less<Side>(value<Side>(i - 1), value<Side>(i))) {
+        throw std::invalid_argument("static_bimap keys must be unique");
+      }
+    }
+  }
+
+  // Position of the first key not less than key (Strict = false) or
+  // greater than key (Strict = true), N if there is none.
+  template <int Side, bool Strict, class Key>
+  constexpr std::size_t bound(Key const& key) const {
+    std::size_t lo = 0;
+    std::size_t hi = N;
+    while (lo < hi) {
+      std::size_t mid = (lo + hi) / 2;
+      if (Strict ? !less<Side>(key, value<Side>(mid))
+                 : less<Side>(value<Side>(mid), key)) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return lo;
+  }
+
+  template <int Side, class Key>
+  constexpr std::size_t find(Key const& key) const {
+    std::size_t position = bound<Side, false>(key);
+    if (position != N && less<Side>(key, value<Side>(position))) {
+      return N;
+    }
+    return position;
+  }
+
+  template <int Side, class Value, class Derived>
+  class base_iterator {
+  protected:
+    const static_bimap* map;
+    std::size_t position;
+    constexpr base_iterator(const static_bimap* map, std::size_t position)
+        : map(map), position(position) {}
+
+  public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = const Value;
+    using difference_type = std::ptrdiff_t;
+    using pointer = Value const*;
+    using reference = Value const&;
+
+    constexpr Value const& operator*() const {
+      return map->template value<Side>(position);
+    }
+
+    constexpr Value const* operator->() const {
+      return &(*(*this));
+    }
+
+    constexpr Derived& operator++() {
+      position++;
+      return static_cast<Derived&>(*this);
+    }
+
+    constexpr Derived operator++(int) {
+      Derived temp = static_cast<Derived&>(*this);
+      ++*this;
+      return temp;
+    }
+
+    constexpr Derived& operator--() {
+      position--;
+      return static_cast<Derived&>(*this);
+    }
+
+    constexpr Derived operator--(int) {
+      Derived temp = static_cast<Derived&>(*this);
+      --*this;
+      return temp;
+    }
+
+    constexpr bool operator==(const base_iterator& rhs) const {
+      return position == rhs.position;
+    }
+
+    constexpr bool operator!=(const base_iterator& rhs) const {
+      return !(*this == rhs);
+    }
+  };
+
+  class right_iterator;
+
+  class left_iterator
+      : public base_iterator<left_side, Left, left_iterator> {
+    friend class static_bimap;
+
+    constexpr left_iterator(const static_bimap* map, std::size_t position)
+        : base_iterator<left_side, Left, left_iterator>(map, position) {}
+
+  public:
+    constexpr right_iterator flip() const {
+      std::size_t p = this->position;
+      return right_iterator(this->map,
+                            p == N ? N : this->map->st.right_rank[p]);
+    }
+  };
+
+  class right_iterator
+      : public base_iterator<right_side, Right, right_iterator> {
+    friend class static_bimap;
+
+    constexpr right_iterator(const static_bimap* map, std::size_t position)
+        : base_iterator<right_side, Right, right_iterator>(map, position) {}
+
+  public:
+    constexpr left_iterator flip() const {
+      std::size_t p = this->position;
+      return left_iterator(this->map,
+                           p == N ? N : this->map->st.right_order[p]);
+    }
+  };
+
+public:
+  constexpr static_bimap(const std::pair<Left, Right> (&pairs)[N],
+                         CompareLeft compare_left = CompareLeft(),
+                         CompareRight compare_right = CompareRight())
+      : st(std::move(compare_left), std::move(compare_right)) {
+    for (std::size_t i = 0; i < N; i++) {
+      st.left_values[i] = pairs[i].first;
+      st.right_values[i] = pairs[i].second;
+    }
+    sort();
+    check_unique<left_side>();
+    check_unique<right_side>();
+  }
+
+  constexpr left_iterator find_left(left_t const& left) const {
+    return left_iterator(this, find<left_side>(left));
+  }
+
+  constexpr right_iterator find_right(right_t const& right) const {
+    return right_iterator(this, find<right_side>(right));
+  }
+
+  constexpr right_t const& at_left(left_t const& key) const {
+    auto it = find_left(key);
+    if (it == end_left()) {
+      throw std::out_of_range("at_left fail");
+    }
+    return *it.flip();
+  }
+
+  constexpr left_t const& at_right(right_t const& key) const {
+    auto it = find_right(key);
+    if (it == end_right()) {
+      throw std::out_of_range("at_right fail");
+    }
+    return *it.flip();
+  }
+
+  constexpr left_iterator lower_bound_left(const left_t& left) const {
+    return left_iterator(this, bound<left_side, false>(left));
+  }
+
+  constexpr left_iterator upper_bound_left(const left_t& left) const {
+    return left_iterator(this, bound<left_side, true>(left));
+  }
+
+  constexpr right_iterator lower_bound_right(const right_t& right) const {
+    return right_iterator(this, bound<right_side, false>(right));
+  }
+
+  constexpr right_iterator upper_bound_right(const right_t& right) const {
+    return right_iterator(this, bound<right_side, true>(right));
+  }
+
+  constexpr left_iterator begin_left() const {
+    return left_iterator(this, 0);
+  }
+
+  constexpr left_iterator end_left() const {
+    return left_iterator(this, N);
+  }
+
+  constexpr right_iterator begin_right() const {
+    return right_iterator(this, 0);
+  }
+
+  constexpr right_iterator end_right() const {
+    return right_iterator(this, N);
+  }
+
+  constexpr bool empty() const {
+    return false;
+  }
+
+  constexpr std::size_t size() const {
+    return N;
+  }
+
+  friend constexpr bool operator==(static_bimap const& a,
+                                   static_bimap const& b) {
+    for (std::size_t i = 0; i < N; i++) {
+      if (a.st.left_values[i] != b.st.left_values[i] ||
+          a.st.right_values[i] != b.st.right_values[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  friend constexpr bool operator!=(static_bimap const& a,
+                                   static_bimap const& b) {
+    return !(a == b);
+  }
+};
+
+template <typename Left, typename Right, std::size_t N>
+constexpr static_bimap<Left, Right, N>
+make_static_bimap(const std::pair<Left, Right> (&pairs)[N]) {
+  return static_bimap<Left, Right, N>(pairs);
+}
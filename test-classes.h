@@ -1,4 +1,5 @@
 #pragma once
+#include <set>
 
 struct test_object {
   int a = 0;
@@ -51,3 +52,38 @@ private:
   int a;
 };
 
+
+// Its copy and assignment throw once copies_left copies have been made. Its move copies
+// and then empties the source, so it may throw too and containers have to
+// copy it. live holds the objects in existence.
+struct throwing_copy {
+  static inline int copies_left = -1;
+  static inline std::set<const throwing_copy *> live;
+  int a;
+  explicit throwing_copy(int b) : a(b) { live.insert(this); }
+  throwing_copy(throwing_copy const &other) : a(other.a) {
+    if (copies_left == 0) {
+      throw std::runtime_error("copy failed");
+    }
+    copies_left--;
+    live.insert(this);
+  }
+  throwing_copy(throwing_copy &&other) : throwing_copy(other) {
+    other.a = -1;
+  }
+  throwing_copy &operator=(throwing_copy const &other) {
+    if (copies_left == 0) {
+      throw std::runtime_error("copy failed");
+    }
+    copies_left--;
+    a = other.a;
+    return *this;
+  }
+  ~throwing_copy() { live.erase(this); }
+  friend bool operator<(throwing_copy const &c, throwing_copy const &b) {
+    return c.a < b.a;
+  }
+  friend bool operator==(throwing_copy const &c, throwing_copy const &b) {
+    return c.a == b.a;
+  }
+};
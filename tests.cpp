@@ -1,6 +1,15 @@
 #include <random>
+#include <string_view>
+#include <thread>
 
 #include "bimap.h"
+#include "bounded_bimap.h"
+#include "compact_bimap.h"
+#include "intrusive_bimap.h"
+#include "multi_index.h"
+#include "sharded_bimap.h"
+#include "small_bimap.h"
+#include "static_bimap.h"
 #include "test-classes.h"
 #include "gtest/gtest.h"
 
@@ -366,6 +375,1412 @@ TEST(bimap, swap) {
   EXPECT_EQ(*b.find_right(3), 3);
 }
 
+TEST(bimap, find_batch) {
+  bimap<int, int> b;
+  for (int i = 0; i < 100; i++) {
+    b.insert(i * 2, -i);
+  }
+  std::vector<int> keys;
+  for (int i = -5; i < 205; i += 3) {
+    keys.push_back(i);
+  }
+  std::vector<decltype(b.end_left())> found(keys.size(), b.end_left());
+  b.find_left_batch(keys.begin(), keys.end(), found.begin());
+  for (size_t i = 0; i < keys.size(); i++) {
+    EXPECT_EQ(found[i], b.find_left(keys[i]));
+  }
+
+  std::vector<int> rights = {0, -7, 3, -99};
+  std::vector<decltype(b.end_right())> found_right;
+  b.find_right_batch(rights.begin(), rights.end(),
+                     std::back_inserter(found_right));
+  ASSERT_EQ(found_right.size(), 4);
+  EXPECT_EQ(*found_right[1].flip(), 14);
+  EXPECT_EQ(found_right[2], b.end_right());
+  EXPECT_EQ(*found_right[3].flip(), 198);
+}
+
+TEST(bimap, at_batch) {
+  bimap<int, int> b;
+  b.insert(1, 10);
+  b.insert(2, 20);
+  b.insert(3, 30);
+
+  std::vector<int> keys = {3, 1, 2, 3}, values;
+  b.at_left_batch(keys.begin(), keys.end(), std::back_inserter(values));
+  EXPECT_EQ(values, std::vector<int>({30, 10, 20, 30}));
+
+  std::vector<int> rights = {20, 10}, lefts(2);
+  b.at_right_batch(rights.begin(), rights.end(), lefts.begin());
+  EXPECT_EQ(lefts, std::vector<int>({2, 1}));
+
+  keys.push_back(4);
+  EXPECT_THROW(
+      b.at_left_batch(keys.begin(), keys.end(), std::back_inserter(values)),
+      std::out_of_range);
+}
+
+TEST(bimap, iterating_after_swap) {
+  bimap<int, int> a, b;
+  for (int i = 0; i < 50; i++) {
+    a.insert(i, 100 - i);
+  }
+  a.swap(b);
+  EXPECT_EQ(a.begin_left(), a.end_left());
+  EXPECT_EQ(a.begin_right(), a.end_right());
+  EXPECT_EQ(*b.begin_left(), 0);
+  EXPECT_EQ(*--b.end_left(), 49);
+  EXPECT_EQ(*b.begin_right(), 51);
+  EXPECT_EQ(*--b.end_right(), 100);
+
+  bimap<int, int> c(std::move(b));
+  c.erase_left(0);
+  c.erase_left(49);
+  int expected = 1;
+  for (auto it = c.begin_left(); it != c.end_left(); it++) {
+    EXPECT_EQ(*it, expected++);
+  }
+  EXPECT_EQ(expected, 49);
+  expected = 99;
+  for (auto it = c.end_right(); it != c.begin_right();) {
+    EXPECT_EQ(*--it, expected--);
+  }
+  EXPECT_EQ(expected, 51);
+}
+
+TEST(compact_bimap, simple) {
+  compact_bimap<int, int> b;
+  EXPECT_EQ(b.begin_left(), b.end_left());
+  EXPECT_EQ(b.memory_usage(), 0);
+  b.insert(4, 10);
+  b.insert(10, 4);
+  EXPECT_EQ(b.insert(4, 7), b.end_left());
+  EXPECT_EQ(*b.find_right(4).flip(), 10);
+  EXPECT_EQ(b.at_left(4), 10);
+  EXPECT_THROW(b.at_right(5), std::out_of_range);
+  EXPECT_EQ(b.end_left().flip(), b.end_right());
+
+  b.insert(7, 1);
+  EXPECT_EQ(*b.lower_bound_left(5), 7);
+  EXPECT_EQ(*b.upper_bound_left(7), 10);
+  EXPECT_EQ(*b.upper_bound_right(1), 4);
+  EXPECT_EQ(*--b.end_right(), 10);
+
+  compact_bimap<int, int> c = b;
+  EXPECT_TRUE(b.erase_right(4));
+  EXPECT_EQ(b.size(), 2);
+  EXPECT_EQ(c.size(), 3);
+  EXPECT_NE(b, c);
+  b.insert(10, 4);
+  EXPECT_EQ(b, c);
+
+  c = std::move(b);
+  EXPECT_TRUE(b.empty());
+  c.erase_left(c.begin_left(), c.end_left());
+  EXPECT_TRUE(c.empty());
+}
+
+TEST(compact_bimap, grow_is_exception_safe) {
+  {
+    compact_bimap<int, throwing_copy> b;
+    for (int i = 0; i < 8; i++) {
+      b.insert(i, throwing_copy(i * 10));
+    }
+    throwing_copy::copies_left = 3;
+    EXPECT_THROW(b.insert(8, throwing_copy(80)), std::runtime_error);
+    throwing_copy::copies_left = -1;
+    EXPECT_EQ(b.size(), 8);
+    for (int i = 0; i < 8; i++) {
+      EXPECT_EQ(b.at_left(i), throwing_copy(i * 10));
+      EXPECT_EQ(throwing_copy::live.count(&b.at_left(i)), 1);
+    }
+    b.insert(8, throwing_copy(80));
+    EXPECT_EQ(b.at_right(throwing_copy(80)), 8);
+  }
+  {
+    // A left key that could be moved is copied along with the right one.
+    compact_bimap<std::string, throwing_copy> b;
+    for (int i = 0; i < 8; i++) {
+      b.insert("key" + std::to_string(i), throwing_copy(i));
+    }
+    throwing_copy::copies_left = 3;
+    EXPECT_THROW(b.insert("key8", throwing_copy(8)), std::runtime_error);
+    throwing_copy::copies_left = -1;
+    for (int i = 0; i < 8; i++) {
+      EXPECT_EQ(b.at_left("key" + std::to_string(i)), throwing_copy(i));
+      EXPECT_EQ(b.at_right(throwing_copy(i)), "key" + std::to_string(i));
+    }
+  }
+  EXPECT_TRUE(throwing_copy::live.empty());
+}
+
+TEST(compact_bimap, compare_to_two_maps) {
+  compact_bimap<int, test_object> b;
+  std::map<int, int> left_view, right_view;
+
+  std::mt19937 e(1488228);
+  for (size_t i = 0; i < 20000; i++) {
+    int l = e() % 1000, r = e() % 1000;
+    if (e() % 3 != 0) {
+      bool inserted = b.insert(l, test_object(r)) != b.end_left();
+      bool expected = left_view.count(l) == 0 && right_view.count(r) == 0;
+      EXPECT_EQ(inserted, expected);
+      if (expected) {
+        left_view[l] = r;
+        right_view[r] = l;
+      }
+    } else {
+      auto it = b.lower_bound_right(test_object(r));
+      if (it != b.end_right()) {
+        EXPECT_EQ(left_view.erase(*it.flip()), 1);
+        EXPECT_EQ(right_view.erase(it->a), 1);
+        b.erase_right(it);
+      }
+    }
+  }
+  ASSERT_EQ(b.size(), left_view.size());
+  auto it = b.begin_left();
+  for (auto const& p : left_view) {
+    EXPECT_EQ(*it, p.first);
+    EXPECT_EQ(it.flip()->a, p.second);
+    ++it;
+  }
+  EXPECT_EQ(it, b.end_left());
+}
+
+TEST(bounded_bimap, lru) {
+  bounded_bimap<int, int> b(3);
+  std::vector<std::pair<int, int>> evicted;
+  b.set_eviction_callback(
+      [&](int l, int r) { evicted.emplace_back(l, r); });
+  b.insert(1, 10);
+  b.insert(2, 20);
+  b.insert(3, 30);
+  EXPECT_EQ(*b.oldest(), 1);
+  EXPECT_EQ(b.at_left(1), 10);
+  EXPECT_EQ(*b.oldest(), 2);
+  EXPECT_EQ(b.insert(3, 40), b.end_left());
+
+  b.insert(4, 40);
+  EXPECT_EQ(b.size(), 3);
+  EXPECT_EQ(evicted, (std::vector<std::pair<int, int>>{{2, 20}}));
+  EXPECT_EQ(b.find_left(2), b.end_left());
+
+  b.find_right(30);
+  b.insert(5, 50);
+  EXPECT_EQ(evicted.back(), std::make_pair(1, 10));
+
+  const auto& cb = b;
+  cb.find_left(4);
+  EXPECT_EQ(*b.oldest(), 4);
+
+  b.erase_right(30);
+  EXPECT_EQ(b.size(), 2);
+  b.set_capacity(1);
+  EXPECT_EQ(b.size(), 1);
+  EXPECT_EQ(*b.begin_left(), 5);
+  EXPECT_EQ(evicted.size(), 3);
+}
+
+TEST(bounded_bimap, fifo) {
+  bounded_bimap<int, int> b(2, eviction_policy::fifo);
+  b.insert(1, 1);
+  b.insert(2, 2);
+  b.at_left(1);
+  b.insert(3, 3);
+  EXPECT_EQ(b.find_left(1), b.end_left());
+  EXPECT_EQ(*b.oldest(), 2);
+
+  bounded_bimap<int, int> copy = b;
+  copy.insert(4, 4);
+  EXPECT_EQ(copy.find_left(2), copy.end_left());
+  EXPECT_NE(b.find_left(2), b.end_left());
+
+  bounded_bimap<int, int> moved(std::move(copy));
+  EXPECT_TRUE(copy.empty());
+  moved.insert(5, 5);
+  EXPECT_EQ(*moved.begin_left(), 4);
+  EXPECT_EQ(*moved.oldest(), 4);
+}
+
+TEST(bounded_bimap, throwing_eviction_callback) {
+  bounded_bimap<int, int> b(2);
+  std::vector<int> evicted;
+  b.set_eviction_callback([&](int l, int) {
+    evicted.push_back(l);
+    throw std::runtime_error("callback failed");
+  });
+  b.insert(1, 10);
+  b.insert(2, 20);
+  EXPECT_THROW(b.insert(3, 30), std::runtime_error);
+  EXPECT_EQ(b.size(), 2);
+  EXPECT_EQ(b.find_left(1), b.end_left());
+  EXPECT_EQ(*b.oldest(), 2);
+  EXPECT_THROW(b.insert(4, 40), std::runtime_error);
+  EXPECT_EQ(b.size(), 2);
+  EXPECT_EQ(*b.oldest(), 3);
+  EXPECT_THROW(b.set_capacity(1), std::runtime_error);
+  EXPECT_EQ(b.size(), 1);
+  EXPECT_EQ(*b.begin_left(), 4);
+  EXPECT_EQ(evicted, (std::vector<int>{1, 2, 3}));
+}
+
+TEST(bimap, for_each) {
+  bimap<int, int> b;
+  for (int i = 0; i < 20; i++) {
+    b.insert(i, (i * 7) % 20);
+  }
+
+  std::vector<std::pair<int, int>> visited;
+  b.for_each_left(5, 9, [&](int l, int r) { visited.emplace_back(l, r); });
+  std::vector<std::pair<int, int>> expected = {{5, 15}, {6, 2}, {7, 9}, {8, 16}};
+  EXPECT_EQ(visited, expected);
+
+  visited.clear();
+  b.for_each_right(-10, 3, [&](int l, int r) { visited.emplace_back(l, r); });
+  expected = {{0, 0}, {3, 1}, {6, 2}};
+  EXPECT_EQ(visited, expected);
+
+  visited.clear();
+  b.for_each_left(30, 40, [&](int l, int r) { visited.emplace_back(l, r); });
+  b.for_each_left(7, 7, [&](int l, int r) { visited.emplace_back(l, r); });
+  EXPECT_TRUE(visited.empty());
+
+  int count = 0, previous = -1;
+  b.for_each_right([&](int l, int r) {
+    EXPECT_EQ(b.at_left(l), r);
+    EXPECT_GT(r, previous);
+    previous = r;
+    count++;
+  });
+  EXPECT_EQ(count, 20);
+  count = 0;
+  b.for_each_left([&](int l, int) { EXPECT_EQ(l, count++); });
+  EXPECT_EQ(count, 20);
+}
+
+TEST(bimap, hinted_operations) {
+  bimap<int, int> b;
+  auto hint = b.end_left();
+  for (int i = 0; i < 1000; i += 2) {
+    hint = b.insert(hint, i, -i);
+    ASSERT_NE(hint, b.end_left());
+  }
+  EXPECT_EQ(b.insert(hint, 500, 1), b.end_left());
+  EXPECT_EQ(b.insert(b.begin_left(), 501, 0), b.end_left());
+  EXPECT_EQ(b.size(), 500);
+
+  std::mt19937 e(42);
+  auto pos = b.begin_left();
+  for (int i = 0; i < 2000; i++) {
+    int key = static_cast<int>(e() % 1100) - 50;
+    EXPECT_EQ(b.find_left(pos, key), b.find_left(key));
+    EXPECT_EQ(b.lower_bound_left(pos, key), b.lower_bound_left(key));
+    auto right = b.lower_bound_right(b.end_right(), -key);
+    EXPECT_EQ(right, b.lower_bound_right(-key));
+    EXPECT_EQ(b.find_right(right, -key), b.find_right(-key));
+    if (b.lower_bound_left(key) != b.end_left()) {
+      pos = b.lower_bound_left(key);
+    }
+  }
+
+  for (int i = 999; i > 0; i -= 2) {
+    EXPECT_NE(b.insert(b.lower_bound_left(i), i, -i), b.end_left());
+  }
+  int expected = 0;
+  for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+    EXPECT_EQ(*it, expected);
+    EXPECT_EQ(*it.flip(), -expected);
+    expected++;
+  }
+  EXPECT_EQ(expected, 1000);
+}
+
+TEST(bimap, bounds_use_comparator_only) {
+  bimap<std::pair<int, int>, int, vector_compare> b(
+      vector_compare(vector_compare::manhattan));
+  b.insert({1, 1}, 1);
+  b.insert({3, 0}, 2);
+  EXPECT_EQ(*b.upper_bound_left({0, 2}), std::make_pair(3, 0));
+  EXPECT_EQ(*b.lower_bound_left({2, 0}), std::make_pair(1, 1));
+  EXPECT_EQ(b.upper_bound_left({0, 3}), b.end_left());
+}
+
+TEST(bimap, sliding_window) {
+  bimap<int, unsigned> b;
+  std::mt19937 e(7);
+  std::map<unsigned, int> rights;
+  for (int i = 0; i < 5000; i++) {
+    unsigned r = e();
+    if (b.insert(i, r) != b.end_left()) {
+      rights[r] = i;
+    }
+    if (b.size() > 100) {
+      EXPECT_EQ(rights.erase(*b.begin_left().flip()), 1);
+      b.pop_front_left();
+    }
+  }
+  ASSERT_EQ(b.size(), 100);
+  EXPECT_EQ(*b.begin_left(), 4900);
+  EXPECT_EQ(*--b.end_left(), 4999);
+  auto it = b.begin_right();
+  for (auto const& p : rights) {
+    EXPECT_EQ(*it, p.first);
+    EXPECT_EQ(*it.flip(), p.second);
+    ++it;
+  }
+  EXPECT_EQ(b.insert(4950, 0), b.end_left());
+  EXPECT_NE(b.insert(-1, 0), b.end_left());
+  EXPECT_EQ(*b.begin_left(), -1);
+}
+
+TEST(bimap, split_join) {
+  bimap<int, int> b;
+  std::mt19937 e(3);
+  for (int i = 0; i < 300; i++) {
+    b.insert(static_cast<int>(e() % 1000), static_cast<int>(e() % 1000));
+  }
+  bimap<int, int> copy = b;
+
+  for (int key : {-1, 100, 500, 990, 2000}) {
+    bimap<int, int> high = b.split_left(key);
+    EXPECT_EQ(b.size() + high.size(), copy.size());
+    EXPECT_TRUE(b.empty() || *--b.end_left() < key);
+    EXPECT_TRUE(high.empty() || *high.begin_left() >= key);
+    for (auto it = high.begin_right(); it != high.end_right(); ++it) {
+      EXPECT_EQ(copy.at_right(*it), *it.flip());
+      EXPECT_EQ(b.find_right(*it), b.end_right());
+    }
+    int previous = INT_MIN;
+    for (auto it = b.begin_right(); it != b.end_right(); ++it) {
+      EXPECT_GT(*it, previous);
+      previous = *it;
+    }
+    b.join(std::move(high));
+    EXPECT_TRUE(high.empty());
+    EXPECT_EQ(b, copy);
+  }
+
+  bimap<int, int> low = b.split_left(500);
+  low.join(std::move(b));
+  EXPECT_EQ(low, copy);
+}
+
+TEST(bimap, join_interleaved) {
+  bimap<int, int> a, b;
+  for (int i = 0; i < 10; i++) {
+    a.insert(2 * i, i);
+    b.insert(2 * i + 1, 100 + i);
+  }
+  bimap<int, int> c;
+  c.insert(5, -1);
+  EXPECT_THROW(b.join(std::move(c)), std::invalid_argument);
+  c.erase_left(5);
+  c.insert(-4, 5);
+  EXPECT_THROW(a.join(std::move(c)), std::invalid_argument);
+  EXPECT_EQ(c.size(), 1);
+  EXPECT_EQ(a.size(), 10);
+
+  a.join(std::move(b));
+  EXPECT_EQ(a.size(), 20);
+  int expected = 0;
+  for (auto it = a.begin_left(); it != a.end_left(); ++it, ++expected) {
+    EXPECT_EQ(*it, expected);
+    EXPECT_EQ(*it.flip(), expected % 2 == 0 ? expected / 2 : 100 + expected / 2);
+  }
+  EXPECT_EQ(*a.begin_right(), 0);
+  EXPECT_EQ(*--a.end_right(), 109);
+}
+
+TEST(sharded_bimap, simple) {
+  sharded_bimap<int, std::string, 4> b;
+  EXPECT_TRUE(b.insert(1, "one"));
+  EXPECT_TRUE(b.insert(2, "two"));
+  EXPECT_FALSE(b.insert(1, "uno"));
+  EXPECT_FALSE(b.insert(3, "two"));
+  EXPECT_EQ(b.size(), 2);
+  EXPECT_EQ(b.at_left(2), "two");
+  EXPECT_EQ(b.at_right("one"), 1);
+  EXPECT_FALSE(b.find_left(3).has_value());
+  EXPECT_THROW(b.at_right("three"), std::out_of_range);
+  EXPECT_TRUE(b.erase_right("one"));
+  EXPECT_FALSE(b.erase_left(1));
+  EXPECT_TRUE(b.insert(3, "one"));
+  EXPECT_TRUE(b.erase_left(2));
+  EXPECT_EQ(b.size(), 1);
+}
+
+TEST(sharded_bimap, concurrent_inserts) {
+  sharded_bimap<int, int, 8> b;
+  std::vector<std::thread> threads;
+  std::atomic<int> inserted{0};
+  for (int t = 0; t < 8; t++) {
+    threads.emplace_back([&, t] {
+      std::mt19937 e(t);
+      for (int i = 0; i < 5000; i++) {
+        int l = e() % 2000, r = e() % 2000;
+        if (e() % 4 == 0) {
+          inserted -= b.erase_left(l);
+        } else {
+          inserted += b.insert(l, r);
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(b.size(), inserted.load());
+  size_t pairs = 0;
+  for (int l = 0; l < 2000; l++) {
+    auto r = b.find_left(l);
+    if (r) {
+      pairs++;
+      EXPECT_EQ(b.at_right(*r), l);
+    }
+  }
+  EXPECT_EQ(pairs, b.size());
+}
+
+TEST(bimap, string_prefix_cache) {
+  // Keys tie on the cached 8-byte prefix in many ways: shared prefixes,
+  // prefixes of each other, embedded zero bytes and bytes above 0x7f.
+  std::vector<std::string> keys = {"",
+                                   "a",
+                                   "abcdefgh",
+                                   "abcdefghi",
+                                   "abcdefgh\xff",
+                                   std::string("abc\0", 4),
+                                   std::string("abc\0\0", 5),
+                                   "abc",
+                                   "https://example.com/a",
+                                   "https://example.com/b",
+                                   "https://example.com",
+                                   "\xff\xfe",
+                                   "\x7f"};
+  bimap<std::string, int> b;
+  std::set<std::string> expected;
+  for (size_t i = 0; i < keys.size(); i++) {
+    EXPECT_NE(b.insert(keys[i], static_cast<int>(i)), b.end_left());
+    EXPECT_EQ(b.insert(keys[i], -1 - static_cast<int>(i)), b.end_left());
+    expected.insert(keys[i]);
+  }
+  std::vector<std::string> order;
+  for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+    order.push_back(*it);
+  }
+  EXPECT_EQ(order, std::vector<std::string>(expected.begin(), expected.end()));
+  for (size_t i = 0; i < keys.size(); i++) {
+    EXPECT_EQ(b.at_left(keys[i]), i);
+    EXPECT_EQ(*b.lower_bound_left(keys[i]), keys[i]);
+  }
+  EXPECT_EQ(*b.upper_bound_left("abcdefgh"), "abcdefghi");
+  EXPECT_EQ(*b.lower_bound_left("https://example.com/"),
+            "https://example.com/a");
+  EXPECT_EQ(b.find_left("abcdefg"), b.end_left());
+
+  bimap<std::string, int, std::greater<std::string>> reversed;
+  for (size_t i = 0; i < keys.size(); i++) {
+    reversed.insert(keys[i], static_cast<int>(i));
+  }
+  order.clear();
+  for (auto it = reversed.begin_left(); it != reversed.end_left(); ++it) {
+    order.push_back(*it);
+  }
+  EXPECT_EQ(order,
+            std::vector<std::string>(expected.rbegin(), expected.rend()));
+}
+
+TEST(small_bimap, inline_then_spill) {
+  small_bimap<int, int, 4> b;
+  EXPECT_TRUE(b.insert(3, 30) != b.end_left());
+  EXPECT_TRUE(b.insert(1, 40) != b.end_left());
+  EXPECT_TRUE(b.insert(2, 10) != b.end_left());
+  EXPECT_TRUE(b.insert(2, 50) == b.end_left());
+  EXPECT_TRUE(b.insert(5, 10) == b.end_left());
+  EXPECT_TRUE(b.is_inline());
+
+  auto it = b.find_left(1);
+  b.insert(0, 20);
+  EXPECT_EQ(*it.flip(), 40);
+  EXPECT_EQ(*--it.flip(), 30);
+  std::vector<int> lefts(b.begin_left(), b.end_left());
+  EXPECT_EQ(lefts, (std::vector<int>{0, 1, 2, 3}));
+  std::vector<int> rights(b.begin_right(), b.end_right());
+  EXPECT_EQ(rights, (std::vector<int>{10, 20, 30, 40}));
+  EXPECT_EQ(*--b.end_right(), 40);
+  EXPECT_EQ(*b.lower_bound_left(2), 2);
+  EXPECT_EQ(*b.upper_bound_right(20), 30);
+  EXPECT_EQ(b.upper_bound_left(3), b.end_left());
+
+  EXPECT_EQ(*b.erase_left(b.find_left(1)), 2);
+  EXPECT_FALSE(b.erase_right(40));
+  EXPECT_TRUE(b.erase_right(20));
+  EXPECT_EQ(b.size(), 2);
+  small_bimap<int, int, 4> copy = b;
+  EXPECT_EQ(copy, b);
+
+  for (int i = 10; i < 20; i++) {
+    b.insert(i, -i);
+  }
+  EXPECT_FALSE(b.is_inline());
+  EXPECT_EQ(b.size(), 12);
+  EXPECT_EQ(b.at_left(2), 10);
+  EXPECT_EQ(b.at_right(-15), 15);
+  EXPECT_EQ(*b.begin_right().flip(), 19);
+  EXPECT_EQ(*b.lower_bound_left(4), 10);
+
+  copy.swap(b);
+  EXPECT_TRUE(b.is_inline());
+  EXPECT_EQ(b.size(), 2);
+  EXPECT_EQ(copy.size(), 12);
+  small_bimap<int, int, 4> moved = std::move(copy);
+  EXPECT_EQ(moved.at_left(19), -19);
+  EXPECT_TRUE(copy.empty());
+}
+
+TEST(small_bimap, failed_spill_keeps_inline_pairs) {
+  {
+    small_bimap<throwing_copy, int, 4> b;
+    for (int i = 0; i < 4; i++) {
+      b.insert(throwing_copy(i), i * 10);
+    }
+    throwing_copy::copies_left = 2;
+    EXPECT_THROW(b.insert(throwing_copy(4), 40), std::runtime_error);
+    throwing_copy::copies_left = -1;
+    EXPECT_TRUE(b.is_inline());
+    EXPECT_EQ(b.size(), 4);
+    for (int i = 0; i < 4; i++) {
+      EXPECT_EQ(b.at_right(i * 10), throwing_copy(i));
+    }
+    b.insert(throwing_copy(4), 40);
+    EXPECT_FALSE(b.is_inline());
+    EXPECT_EQ(b.at_left(throwing_copy(2)), 20);
+  }
+  EXPECT_TRUE(throwing_copy::live.empty());
+}
+
+namespace {
+// Throws once compares_left comparisons have been made.
+struct throwing_less {
+  static inline int compares_left = -1;
+
+  bool operator()(const std::string& a, const std::string& b) const {
+    if (compares_left == 0) {
+      throw std::runtime_error("compare failed");
+    }
+    compares_left--;
+    return a < b;
+  }
+};
+} // namespace
+
+TEST(small_bimap, failed_spill_moves_pairs_back) {
+  // Keys that move without throwing are moved into the bimap; a throw at
+  // any point of the spill has to leave every inline key in place.
+  for (int budget = 0; budget < 40; budget++) {
+    small_bimap<std::string, int, 4, throwing_less> b;
+    for (int i = 0; i < 4; i++) {
+      b.insert("key" + std::to_string(i), i);
+    }
+    throwing_less::compares_left = budget;
+    try {
+      b.insert("key4", 4);
+    } catch (std::runtime_error const&) {
+    }
+    throwing_less::compares_left = -1;
+    EXPECT_EQ(b.size(), b.find_left("key4") == b.end_left() ? 4u : 5u);
+    for (int i = 0; i < 4; i++) {
+      EXPECT_EQ(b.at_left("key" + std::to_string(i)), i);
+      EXPECT_EQ(b.at_right(i), "key" + std::to_string(i));
+    }
+  }
+}
+
+namespace {
+constexpr auto status_names = make_static_bimap<int, std::string_view>(
+    {{404, "not found"}, {200, "ok"}, {500, "server error"}, {301, "moved"}});
+
+static_assert(status_names.size() == 4);
+static_assert(status_names.at_left(200) == "ok");
+static_assert(status_names.at_right("moved") == 301);
+static_assert(status_names.find_left(201) == status_names.end_left());
+static_assert(*status_names.begin_left() == 200);
+static_assert(*status_names.begin_right() == "moved");
+static_assert(*status_names.lower_bound_left(302) == 404);
+} // namespace
+
+TEST(static_bimap, queries) {
+  std::vector<int> codes(status_names.begin_left(), status_names.end_left());
+  EXPECT_EQ(codes, (std::vector<int>{200, 301, 404, 500}));
+  auto it = status_names.find_right("server error");
+  EXPECT_EQ(*it.flip(), 500);
+  EXPECT_EQ(*--it, "ok");
+  EXPECT_EQ(*it.flip().flip(), "ok");
+  EXPECT_EQ(status_names.upper_bound_right("server error"),
+            status_names.end_right());
+  EXPECT_THROW(status_names.at_left(100), std::out_of_range);
+  EXPECT_THROW((make_static_bimap<int, int>({{1, 2}, {3, 2}})),
+               std::invalid_argument);
+}
+
+TEST(bimap, insert_or_assign) {
+  bimap<int, int> b;
+  EXPECT_TRUE(b.insert_or_assign_left(1, 10).second);
+  EXPECT_TRUE(b.insert_or_assign_right(20, 2).second);
+  auto result = b.insert_or_assign_left(1, 30);
+  EXPECT_FALSE(result.second);
+  EXPECT_EQ(*result.first.flip(), 30);
+  EXPECT_EQ(b.find_right(10), b.end_right());
+
+  // 2 takes 30 away from 1, whose pair is erased.
+  EXPECT_FALSE(b.insert_or_assign_left(2, 30).second);
+  EXPECT_EQ(b.size(), 1);
+  EXPECT_EQ(b.at_right(30), 2);
+  // 30 is present, so its pair takes 5 as the new left key.
+  EXPECT_FALSE(b.insert_or_assign_right(30, 5).second);
+  EXPECT_EQ(b.size(), 1);
+  EXPECT_EQ(b.at_left(5), 30);
+
+  std::map<int, int> left_to_right = {{5, 30}};
+  std::map<int, int> right_to_left = {{30, 5}};
+  std::mt19937 e(1);
+  for (int i = 0; i < 20000; i++) {
+    int left = e() % 64;
+    int right = e() % 64;
+    bool by_left = e() % 2 == 0;
+    bool existed = by_left ? left_to_right.count(left) != 0
+                           : right_to_left.count(right) != 0;
+    if (left_to_right.count(left) != 0) {
+      right_to_left.erase(left_to_right[left]);
+    }
+    if (right_to_left.count(right) != 0) {
+      left_to_right.erase(right_to_left[right]);
+    }
+    left_to_right[left] = right;
+    right_to_left[right] = left;
+    if (by_left) {
+      auto r = b.insert_or_assign_left(left, right);
+      EXPECT_EQ(r.second, !existed);
+      EXPECT_EQ(*r.first, left);
+    } else {
+      auto r = b.insert_or_assign_right(right, left);
+      EXPECT_EQ(r.second, !existed);
+      EXPECT_EQ(*r.first, right);
+    }
+    ASSERT_EQ(b.size(), left_to_right.size());
+  }
+  auto it = b.begin_left();
+  for (auto const& p : left_to_right) {
+    EXPECT_EQ(*it, p.first);
+    EXPECT_EQ(*it.flip(), p.second);
+    ++it;
+  }
+  auto rit = b.begin_right();
+  for (auto const& p : right_to_left) {
+    EXPECT_EQ(*rit, p.first);
+    ++rit;
+  }
+}
+
+TEST(bimap, replace_in_place) {
+  bimap<int, std::string> b;
+  for (int i = 0; i < 10; i++) {
+    b.insert(i, std::to_string(i * 10));
+  }
+  auto it = b.find_left(3);
+  const std::string* right = &*it.flip();
+  EXPECT_TRUE(b.replace_right(it, "95"));
+  EXPECT_EQ(&*it.flip(), right);
+  EXPECT_EQ(b.at_left(3), "95");
+  EXPECT_EQ(b.find_right("30"), b.end_right());
+  EXPECT_EQ(*--b.end_right(), "95");
+  EXPECT_EQ(*--b.find_right("95"), "90");
+
+  EXPECT_FALSE(b.replace_right(it, "40"));
+  EXPECT_EQ(b.at_left(3), "95");
+  EXPECT_EQ(b.at_left(4), "40");
+  EXPECT_TRUE(b.replace_right(it, "95"));
+
+  auto rit = b.find_right("0");
+  EXPECT_TRUE(b.replace_left(rit, 100));
+  EXPECT_EQ(*rit.flip(), 100);
+  EXPECT_EQ(*b.begin_left(), 1);
+  EXPECT_FALSE(b.replace_left(rit, 5));
+  EXPECT_EQ(b.at_right("0"), 100);
+  EXPECT_EQ(b.size(), 10);
+}
+
+TEST(bimap, compact) {
+  bimap<int, std::string> b;
+  std::map<int, std::string> expected;
+  std::mt19937 e(3);
+  for (int i = 0; i < 2000; i++) {
+    int key = e() % 500;
+    if (e() % 3 == 0) {
+      b.erase_left(key);
+      expected.erase(key);
+    } else if (b.insert(key, std::to_string(key * 7)) != b.end_left()) {
+      expected[key] = std::to_string(key * 7);
+    }
+  }
+  auto check = [&](bimap<int, std::string> const& m,
+                   std::map<int, std::string> const& pairs) {
+    ASSERT_EQ(m.size(), pairs.size());
+    auto it = m.begin_left();
+    for (auto const& p : pairs) {
+      EXPECT_EQ(*it, p.first);
+      EXPECT_EQ(*it.flip(), p.second);
+      EXPECT_EQ(m.at_right(p.second), p.first);
+      ++it;
+    }
+    EXPECT_EQ(it, m.end_left());
+  };
+
+  b.compact();
+  check(b, expected);
+  b.compact_right();
+  check(b, expected);
+
+  // Nodes of the block and heap nodes mix freely afterwards.
+  for (int i = 500; i < 600; i++) {
+    b.insert(i, std::to_string(i * 7));
+    expected[i] = std::to_string(i * 7);
+  }
+  b.erase_left(b.begin_left(), b.find_left(250));
+  expected.erase(expected.begin(), expected.lower_bound(250));
+  check(b, expected);
+
+  bimap<int, std::string> high = b.split_left(400);
+  std::map<int, std::string> expected_high(expected.lower_bound(400),
+                                           expected.end());
+  expected.erase(expected.lower_bound(400), expected.end());
+  b.compact();
+  check(b, expected);
+  check(high, expected_high);
+  b = bimap<int, std::string>();
+  check(high, expected_high);
+  high.compact();
+  check(high, expected_high);
+}
+
+TEST(bimap, failed_compact_keeps_pairs) {
+  {
+    bimap<std::string, throwing_copy> b;
+    for (int i = 0; i < 20; i++) {
+      b.insert("key" + std::to_string(i), throwing_copy(i));
+    }
+    throwing_copy::copies_left = 5;
+    EXPECT_THROW(b.compact(), std::runtime_error);
+    throwing_copy::copies_left = -1;
+    ASSERT_EQ(b.size(), 20u);
+    for (int i = 0; i < 20; i++) {
+      auto it = b.find_left("key" + std::to_string(i));
+      ASSERT_TRUE(it != b.end_left());
+      EXPECT_EQ(*it.flip(), throwing_copy(i));
+      EXPECT_EQ(b.at_right(throwing_copy(i)), "key" + std::to_string(i));
+    }
+    for (auto it = b.begin_left(), next = ++b.begin_left();
+         next != b.end_left(); it = next++) {
+      EXPECT_LT(*it, *next);
+    }
+    b.compact();
+    EXPECT_EQ(b.at_left("key7"), throwing_copy(7));
+  }
+  EXPECT_TRUE(throwing_copy::live.empty());
+}
+
+TEST(bimap, diff_and_apply_delta) {
+  bimap<int, int> a;
+  for (int i = 0; i < 1000; i++) {
+    a.insert(i, i * 10);
+  }
+  bimap<int, int> b = a;
+  b.erase_left(5);
+  b.erase_left(500);
+  b.replace_right(b.find_left(7), 5);
+  b.insert(2000, 70);
+  b.insert(-1, 50);
+  // 10 and 11 exchange their right keys.
+  b.erase_left(11);
+  b.replace_right(b.find_left(10), 110);
+  b.insert(11, 100);
+
+  auto delta = decltype(a)::diff(a, b);
+  EXPECT_EQ(delta.removed, (std::vector<int>{5, 500}));
+  EXPECT_EQ(delta.changed, (std::vector<std::pair<int, int>>{
+                               {7, 5}, {10, 110}, {11, 100}}));
+  EXPECT_EQ(delta.added,
+            (std::vector<std::pair<int, int>>{{-1, 50}, {2000, 70}}));
+  EXPECT_TRUE(decltype(a)::diff(b, b).empty());
+
+  auto bytes = encode(delta);
+  auto decoded = decode<int, int>(bytes);
+  EXPECT_EQ(decoded.removed, delta.removed);
+  EXPECT_EQ(decoded.changed, delta.changed);
+  EXPECT_EQ(decoded.added, delta.added);
+  bytes.pop_back();
+  EXPECT_THROW((decode<int, int>(bytes)), std::invalid_argument);
+
+  bimap<int, int> c = a;
+  c.apply_delta(decoded);
+  EXPECT_EQ(c, b);
+
+  // Applied again, the delta no longer fits and nothing changes.
+  EXPECT_THROW(c.apply_delta(delta), std::invalid_argument);
+  EXPECT_EQ(c, b);
+  bimap<int, int> d = a;
+  d.insert(3000, 5);
+  EXPECT_THROW(d.apply_delta(delta), std::invalid_argument);
+  EXPECT_EQ(d.size(), a.size() + 1);
+}
+
+TEST(bimap, apply_delta_rejects_unsorted_lists) {
+  bimap<int, int> a;
+  for (int i = 0; i < 10; i++) {
+    a.insert(i, i);
+  }
+  bimap<int, int> copy = a;
+  bimap_delta<int, int> twice_removed;
+  twice_removed.removed = {3, 3};
+  EXPECT_THROW(a.apply_delta(twice_removed), std::invalid_argument);
+  bimap_delta<int, int> twice_added;
+  twice_added.added = {{20, 1}, {20, 2}};
+  EXPECT_THROW(a.apply_delta(twice_added), std::invalid_argument);
+  bimap_delta<int, int> descending;
+  descending.removed = {4, 2};
+  EXPECT_THROW(a.apply_delta(descending), std::invalid_argument);
+  bimap_delta<int, int> removed_and_changed;
+  removed_and_changed.removed = {5};
+  removed_and_changed.changed = {{5, 50}};
+  EXPECT_THROW(a.apply_delta(removed_and_changed), std::invalid_argument);
+  EXPECT_EQ(a, copy);
+}
+
+TEST(bimap, negative_lookup_filter) {
+  bimap<int, int> b;
+  b.enable_left_filter(16);
+  b.enable_right_filter();
+  for (int i = 0; i < 1000; i++) {
+    EXPECT_TRUE(b.insert(i, -i) != b.end_left());
+  }
+  EXPECT_FALSE(b.insert(5, 7) != b.end_left());
+  EXPECT_FALSE(b.insert(7, -5) != b.end_left());
+  for (int i = 0; i < 1000; i += 2) {
+    EXPECT_TRUE(b.erase_left(i));
+  }
+  for (int i = 0; i < 1000; i++) {
+    EXPECT_EQ(b.find_left(i) != b.end_left(), i % 2 == 1);
+    EXPECT_EQ(b.find_right(-i) != b.end_right(), i % 2 == 1);
+  }
+  EXPECT_FALSE(b.erase_right(-2));
+  EXPECT_TRUE(b.replace_right(b.find_left(1), 5000));
+  EXPECT_TRUE(b.find_right(5000) != b.end_right());
+  EXPECT_TRUE(b.find_right(-1) == b.end_right());
+
+  size_t misses = 0;
+  for (int i = 1000; i < 101000; i++) {
+    misses += b.find_left(i) == b.end_left();
+  }
+  EXPECT_EQ(misses, 100000u);
+  auto stats = b.left_filter_stats();
+  EXPECT_EQ(stats.keys, 500u);
+  EXPECT_GT(stats.memory_usage, 0u);
+  EXPECT_LT(stats.false_positive_rate, 0.05);
+
+  bimap<int, int> high = b.split_left(500);
+  EXPECT_EQ(high.left_filter_stats().keys, 250u);
+  EXPECT_TRUE(high.find_left(501) != high.end_left());
+  EXPECT_TRUE(b.find_left(501) == b.end_left());
+  b.join(std::move(high));
+  EXPECT_EQ(b.right_filter_stats().keys, 500u);
+  EXPECT_TRUE(b.find_left(501) != b.end_left());
+
+  bimap<int, int> copy = b;
+  bimap<int, int> empty;
+  copy.swap(empty);
+  EXPECT_EQ(empty.left_filter_stats().keys, 500u);
+  EXPECT_EQ(copy.left_filter_stats().keys, 0u);
+  EXPECT_TRUE(empty.find_right(-3) != empty.end_right());
+  // Copy-assignment takes the filter setup of the source, as copying does.
+  bimap<int, int> assigned;
+  assigned.enable_left_filter();
+  assigned = copy;
+  EXPECT_EQ(assigned.left_filter_stats().memory_usage, 0u);
+  assigned = empty;
+  EXPECT_EQ(assigned.left_filter_stats().keys, 500u);
+  EXPECT_EQ(assigned.right_filter_stats().keys, 500u);
+  // A map joined into keeps its filters, even when it was empty.
+  bimap<int, int> joined;
+  joined.enable_right_filter();
+  bimap<int, int> source = b;
+  source.disable_filters();
+  joined.join(std::move(source));
+  EXPECT_EQ(joined.left_filter_stats().memory_usage, 0u);
+  EXPECT_EQ(joined.right_filter_stats().keys, 500u);
+  EXPECT_TRUE(joined.find_right(-3) != joined.end_right());
+  b.disable_filters();
+  EXPECT_EQ(b.left_filter_stats().keys, 0u);
+  EXPECT_TRUE(b.find_left(3) != b.end_left());
+}
+
+namespace {
+struct throwing_copy_hash {
+  std::size_t operator()(const throwing_copy& value) const {
+    return std::hash<int>()(value.a);
+  }
+};
+} // namespace
+
+TEST(bimap, filter_survives_failed_rekey) {
+  bimap<int, throwing_copy> b;
+  b.enable_right_filter<throwing_copy_hash>();
+  for (int i = 0; i < 10; i++) {
+    b.insert(i, throwing_copy(i * 10));
+  }
+  throwing_copy::copies_left = 0;
+  EXPECT_THROW(b.replace_right(b.find_left(1), throwing_copy(15)),
+               std::runtime_error);
+  throwing_copy::copies_left = -1;
+  EXPECT_EQ(b.at_left(1), throwing_copy(10));
+  EXPECT_TRUE(b.find_right(throwing_copy(10)) != b.end_right());
+  EXPECT_EQ(b.right_filter_stats().keys, 10u);
+}
+
+TEST(multi_index, three_keys_per_record) {
+  multi_index<int, std::string, unique_key<std::string, std::greater<>>> users;
+  EXPECT_TRUE(users.insert(1, "ada", "lovelace") != users.end<0>());
+  EXPECT_TRUE(users.insert(2, "alan", "turing") != users.end<0>());
+  EXPECT_TRUE(users.insert(3, "grace", "hopper") != users.end<0>());
+  // A clash in any index rejects the whole record.
+  EXPECT_TRUE(users.insert(4, "ada", "king") == users.end<0>());
+  EXPECT_TRUE(users.insert(4, "kurt", "hopper") == users.end<0>());
+  EXPECT_TRUE(users.insert(2, "kurt", "godel") == users.end<0>());
+  EXPECT_EQ(users.size(), 3u);
+  EXPECT_FALSE(users.contains<0>(4));
+  EXPECT_FALSE(users.contains<2>("king"));
+
+  auto it = users.find<1>("alan");
+  EXPECT_EQ(it.get<0>(), 2);
+  EXPECT_EQ(*it.project<2>(), "turing");
+  EXPECT_EQ((users.at<2, 1>("hopper")), "grace");
+  EXPECT_THROW((users.at<0, 1>(7)), std::out_of_range);
+  EXPECT_TRUE(users.end<1>().project<0>() == users.end<0>());
+
+  std::vector<std::string> handles;
+  for (auto h = users.begin<2>(); h != users.end<2>(); ++h) {
+    handles.push_back(*h);
+  }
+  EXPECT_EQ(handles,
+            (std::vector<std::string>{"turing", "lovelace", "hopper"}));
+  EXPECT_EQ(*users.lower_bound<1>("b"), "grace");
+
+  multi_index<int, std::string, unique_key<std::string, std::greater<>>> copy =
+      users;
+  EXPECT_TRUE(copy == users);
+  EXPECT_TRUE(users.erase<2>("lovelace"));
+  EXPECT_FALSE(users.erase<1>("ada"));
+  EXPECT_TRUE(users.find<0>(1) == users.end<0>());
+  EXPECT_TRUE(users.insert(5, "ada", "byron") != users.end<0>());
+  auto next = users.erase(users.find<1>("alan"));
+  EXPECT_EQ(*next, "grace");
+  EXPECT_EQ(users.size(), 2u);
+  EXPECT_TRUE(copy != users);
+  copy = std::move(users);
+  EXPECT_EQ((copy.at<0, 2>(5)), "byron");
+  EXPECT_TRUE(users.empty());
+}
+
+namespace {
+struct connection : intrusive_bimap_hook<> {
+  int socket = 0;
+  std::string session;
+};
+
+struct by_socket {
+  const int& operator()(const connection& c) const {
+    return c.socket;
+  }
+};
+
+struct by_session {
+  const std::string& operator()(const connection& c) const {
+    return c.session;
+  }
+};
+
+struct directed_less {
+  bool descending = false;
+
+  bool operator()(int a, int b) const {
+    return descending ? b < a : a < b;
+  }
+};
+} // namespace
+
+TEST(intrusive_bimap, links_caller_objects) {
+  std::vector<connection> pool(100);
+  for (int i = 0; i < 100; i++) {
+    pool[i].socket = (i * 37) % 100;
+    pool[i].session = "s" + std::to_string(i);
+  }
+  intrusive_bimap<connection, by_socket, by_session> index;
+  for (auto& c : pool) {
+    EXPECT_TRUE(index.insert(c) != index.end_left());
+    EXPECT_TRUE(c.is_linked());
+  }
+  connection clash;
+  clash.socket = 1000;
+  clash.session = "s5";
+  EXPECT_TRUE(index.insert(clash) == index.end_left());
+  EXPECT_FALSE(clash.is_linked());
+  EXPECT_EQ(index.size(), 100u);
+  // Linked objects are refused, by this map or another of the same Tag.
+  EXPECT_TRUE(index.insert(pool[0]) == index.end_left());
+  intrusive_bimap<connection, by_socket, by_session> other;
+  EXPECT_TRUE(other.insert(pool[0]) == other.end_left());
+  EXPECT_TRUE(other.empty());
+  EXPECT_EQ(index.size(), 100u);
+
+  EXPECT_EQ(&*index.find_left(37), &pool[1]);
+  EXPECT_EQ(&*index.find_right("s2"), &pool[2]);
+  EXPECT_EQ(index.find_left(74).flip()->session, "s2");
+  EXPECT_TRUE(index.iterator_to_right(pool[7]) == index.find_right("s7"));
+  int expected = 0;
+  for (auto it = index.begin_left(); it != index.end_left(); ++it) {
+    EXPECT_EQ(it->socket, expected++);
+  }
+
+  index.erase(pool[3]);
+  EXPECT_FALSE(pool[3].is_linked());
+  EXPECT_EQ(index.erase_right("s4"), &pool[4]);
+  EXPECT_EQ(index.erase_left(pool[4].socket), nullptr);
+  pool[3].socket = 1000;
+  EXPECT_TRUE(index.insert(pool[3]) != index.end_left());
+  EXPECT_EQ(&*index.begin_left().flip(), &*index.find_right("s0"));
+  EXPECT_EQ(&*std::prev(index.end_left()), &pool[3]);
+
+  connection copy = pool[3];
+  EXPECT_FALSE(copy.is_linked());
+  intrusive_bimap<connection, by_socket, by_session> moved(std::move(index));
+  EXPECT_TRUE(index.empty());
+  EXPECT_EQ(moved.size(), 99u);
+  moved.clear();
+  for (auto& c : pool) {
+    EXPECT_FALSE(c.is_linked());
+  }
+}
+
+TEST(intrusive_bimap, swap_exchanges_comparators) {
+  std::vector<connection> pool(10);
+  using index_t =
+      intrusive_bimap<connection, by_socket, by_session, directed_less>;
+  index_t reversed(directed_less{true});
+  index_t plain;
+  for (int i = 0; i < 9; i++) {
+    pool[i].socket = i;
+    pool[i].session = "s" + std::to_string(i);
+    reversed.insert(pool[i]);
+  }
+  reversed.swap(plain);
+  EXPECT_TRUE(reversed.empty());
+  pool[9].socket = -1;
+  pool[9].session = "s9";
+  EXPECT_TRUE(plain.insert(pool[9]) != plain.end_left());
+  std::vector<int> sockets;
+  for (auto it = plain.begin_left(); it != plain.end_left(); ++it) {
+    sockets.push_back(it->socket);
+  }
+  EXPECT_EQ(sockets, (std::vector<int>{8, 7, 6, 5, 4, 3, 2, 1, 0, -1}));
+  EXPECT_EQ(&*plain.find_left(3), &pool[3]);
+  index_t moved(std::move(plain));
+  EXPECT_EQ(&*moved.find_left(5), &pool[5]);
+  EXPECT_EQ(moved.begin_left()->socket, 8);
+}
+
+TEST(bimap, swap_exchanges_comparators) {
+  using map_t = bimap<int, int, directed_less, directed_less>;
+  map_t reversed(directed_less{true}, directed_less{false});
+  map_t plain;
+  for (int i = 0; i < 9; i++) {
+    reversed.insert(i, 10 * i);
+  }
+  reversed.swap(plain);
+  EXPECT_TRUE(reversed.empty());
+  EXPECT_TRUE(plain.insert(-1, -10) != plain.end_left());
+  std::vector<int> lefts;
+  for (auto it = plain.begin_left(); it != plain.end_left(); ++it) {
+    lefts.push_back(*it);
+  }
+  EXPECT_EQ(lefts, (std::vector<int>{8, 7, 6, 5, 4, 3, 2, 1, 0, -1}));
+  EXPECT_EQ(plain.at_left(3), 30);
+  map_t copy(plain);
+  EXPECT_EQ(*copy.begin_left(), 8);
+  map_t moved(std::move(plain));
+  EXPECT_EQ(moved.at_left(5), 50);
+  EXPECT_EQ(*moved.begin_left(), 8);
+}
+
+namespace {
+size_t counted_compares = 0;
+
+struct counting_less {
+  bool operator()(int a, int b) const {
+    counted_compares++;
+    return a < b;
+  }
+};
+} // namespace
+
+TEST(bimap, adaptive_lookups) {
+  bimap<int, int, counting_less> b;
+  b.enable_adaptive_lookups();
+  for (int i = 0; i < 4096; i++) {
+    b.insert(i, -i);
+  }
+  std::mt19937 e(3);
+  for (int i = 0; i < 20000; i++) {
+    int key = e() % 8 == 0 ? int(e() % 4096) : int(e() % 4);
+    EXPECT_EQ(b.at_left(key), -key);
+  }
+  for (int hot = 0; hot < 4; hot++) {
+    counted_compares = 0;
+    EXPECT_TRUE(b.find_left(hot) != b.end_left());
+    EXPECT_LE(counted_compares, 12u);
+  }
+  int expected = 0;
+  for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+    EXPECT_EQ(*it, expected++);
+  }
+  EXPECT_EQ(expected, 4096);
+  EXPECT_TRUE(b.erase_left(2));
+  EXPECT_TRUE(b.find_left(2) == b.end_left());
+  EXPECT_EQ(b.at_right(-3), 3);
+  b.disable_adaptive_lookups();
+  EXPECT_EQ(b.size(), 4095u);
+}
+
+TEST(bimap, adaptive_lookups_survive_moves) {
+  bimap<int, int, counting_less> b;
+  b.enable_adaptive_lookups();
+  for (int i = 0; i < 4096; i++) {
+    b.insert(i, -i);
+  }
+  bimap<int, int, counting_less> moved(std::move(b));
+  bimap<int, int, counting_less> swapped;
+  swapped.swap(moved);
+  bimap<int, int, counting_less> high = swapped.split_left(2048);
+  // A map joined into keeps its own setup.
+  bimap<int, int, counting_less> joined;
+  joined.enable_adaptive_lookups();
+  joined.join(swapped.split_left(1024));
+  for (int i = 0; i < 2000; i++) {
+    EXPECT_EQ(swapped.at_left(500 + i % 4), -500 - i % 4);
+    EXPECT_EQ(high.at_left(3000 + i % 4), -3000 - i % 4);
+    EXPECT_EQ(joined.at_left(1500 + i % 4), -1500 - i % 4);
+  }
+  for (int hot = 0; hot < 4; hot++) {
+    counted_compares = 0;
+    EXPECT_TRUE(swapped.find_left(500 + hot) != swapped.end_left());
+    EXPECT_TRUE(high.find_left(3000 + hot) != high.end_left());
+    EXPECT_TRUE(joined.find_left(1500 + hot) != joined.end_left());
+    EXPECT_LE(counted_compares, 36u);
+  }
+}
+
+namespace {
+struct sum_of_right {
+  using value_type = long long;
+  static value_type identity() {
+    return 0;
+  }
+  static value_type of(const int&, const int& right) {
+    return right;
+  }
+  static value_type combine(value_type a, value_type b) {
+    return a + b;
+  }
+};
+
+// Not commutative: the lefts in order, to check the order of combine.
+struct lefts_in_order {
+  using value_type = std::vector<int>;
+  static value_type identity() {
+    return {};
+  }
+  static value_type of(const int& left, const int&) {
+    return {left};
+  }
+  static value_type combine(value_type a, value_type const& b) {
+    a.insert(a.end(), b.begin(), b.end());
+    return a;
+  }
+};
+} // namespace
+
+TEST(bimap, range_aggregates) {
+  augmented_bimap<int, int, sum_of_right, lefts_in_order> b;
+  std::map<int, int> model;
+  std::mt19937 e(17);
+  auto check = [&] {
+    for (int i = 0; i < 20; i++) {
+      int lo = int(e() % 1100) - 50;
+      int hi = lo + int(e() % 400);
+      long long sum = 0;
+      for (auto it = model.lower_bound(lo); it != model.end() && it->first < hi;
+           ++it) {
+        sum += it->second;
+      }
+      EXPECT_EQ(b.aggregate_left(lo, hi), sum);
+      std::vector<int> lefts;
+      for (auto const& pair : model) {
+        if (pair.second >= lo && pair.second < hi) {
+          lefts.push_back(pair.first);
+        }
+      }
+      std::vector<int> by_right;
+      auto it = b.lower_bound_right(lo);
+      for (; it != b.end_right() && *it < hi; ++it) {
+        by_right.push_back(*it.flip());
+      }
+      EXPECT_EQ(b.aggregate_right(lo, hi), by_right);
+      std::sort(lefts.begin(), lefts.end());
+      std::sort(by_right.begin(), by_right.end());
+      EXPECT_EQ(lefts, by_right);
+    }
+  };
+  for (int step = 0; step < 3000; step++) {
+    int left = int(e() % 1000);
+    int right = int(e() % 1000);
+    switch (e() % 5) {
+    case 0:
+    case 1:
+      if (b.insert(left, right) != b.end_left()) {
+        model[left] = right;
+      }
+      break;
+    case 2:
+      if (b.erase_left(left)) {
+        model.erase(left);
+      }
+      break;
+    case 3:
+      if (model.count(left) != 0 &&
+          b.replace_right(b.find_left(left), right)) {
+        model[left] = right;
+      }
+      break;
+    default:
+      b.insert_or_assign_left(left, right);
+      model.clear();
+      for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+        model[*it] = *it.flip();
+      }
+    }
+    if (step % 100 == 0) {
+      check();
+    }
+  }
+  auto high = b.split_left(500);
+  EXPECT_EQ(b.aggregate_left(500, 1000), 0);
+  b.join(std::move(high));
+  b.compact();
+  check();
+  EXPECT_EQ(b.aggregate_left(10, 10), 0);
+}
+
+namespace {
+size_t projections = 0;
+
+struct squared_norm {
+  long long operator()(std::pair<int, int> const& v) const {
+    projections++;
+    return 1LL * v.first * v.first + 1LL * v.second * v.second;
+  }
+};
+} // namespace
+
+TEST(bimap, projected_key_cache) {
+  using by_norm = projected_less<squared_norm>;
+  bimap<std::pair<int, int>, int, by_norm> b;
+  projections = 0;
+  for (int i = 0; i < 1000; i++) {
+    b.insert({i, -i}, i);
+  }
+  // One projection for the search, one for the node.
+  EXPECT_EQ(projections, 2000u);
+  projections = 0;
+  EXPECT_TRUE(b.find_left({-3, 3}) != b.end_left());
+  EXPECT_EQ(b.at_left({7, 7}), 7);
+  EXPECT_TRUE(b.insert({-5, 5}, 2000) == b.end_left());
+  EXPECT_TRUE(b.find_left({1, 1000}) == b.end_left());
+  EXPECT_EQ(projections, 4u);
+
+  int expected = 0;
+  for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+    EXPECT_EQ(it->first, expected++);
+  }
+  EXPECT_EQ(*b.lower_bound_left({20, 0}), std::make_pair(15, -15));
+  EXPECT_TRUE(b.erase_left({-999, 999}));
+  EXPECT_EQ(b.size(), 999u);
+  EXPECT_TRUE(by_norm()(std::make_pair(1, 1), std::make_pair(0, 2)));
+}
+
+TEST(bimap, erase_if) {
+  augmented_bimap<int, int, sum_of_right> b;
+  b.enable_right_filter();
+  std::map<int, int> model;
+  std::mt19937 e(23);
+  for (int i = 0; i < 5000; i++) {
+    int left = int(e() % 100000);
+    int right = int(e() % 100000);
+    if (b.insert(left, right) != b.end_left()) {
+      model[left] = right;
+    }
+  }
+  // Matching 1 in 50 pairs unlinks them one by one; matching all but 1 in
+  // 10 rebuilds both trees.
+  for (int modulus : {50, 10}) {
+    auto matches = [modulus](int const& left, int const& right) {
+      return ((left + right) % modulus == 0) == (modulus == 50);
+    };
+    size_t expected = 0;
+    for (auto it = model.begin(); it != model.end();) {
+      if (matches(it->first, it->second)) {
+        it = model.erase(it);
+        expected++;
+      } else {
+        ++it;
+      }
+    }
+    auto erased = erase_if(b, matches);
+    EXPECT_EQ(erased, expected);
+    EXPECT_EQ(b.size(), model.size());
+    auto it = b.begin_left();
+    long long sum = 0;
+    for (auto const& pair : model) {
+      EXPECT_EQ(*it, pair.first);
+      EXPECT_EQ(*it.flip(), pair.second);
+      EXPECT_EQ(b.at_right(pair.second), pair.first);
+      sum += pair.second;
+      ++it;
+    }
+    EXPECT_TRUE(it == b.end_left());
+    int prev = -1;
+    for (auto r = b.begin_right(); r != b.end_right(); ++r) {
+      EXPECT_LT(prev, *r);
+      prev = *r;
+    }
+    EXPECT_EQ(b.aggregate_left(0, 100000), sum);
+    EXPECT_EQ(b.right_filter_stats().keys, model.size());
+  }
+  EXPECT_TRUE(b.insert(100001, 100001) != b.end_left());
+  EXPECT_EQ(b.erase_if([](int const&, int const&) { return true; }),
+            model.size() + 1);
+  EXPECT_TRUE(b.empty());
+  EXPECT_TRUE(b.begin_right() == b.end_right());
+}
+
 template <typename T>
 std::vector<std::pair<T, T>>
 eliminate_same(std::vector<T> &lefts, std::vector<T> &rights, std::mt19937 &e) {
@@ -392,6 +1807,11 @@ eliminate_same(std::vector<T> &lefts, std::vector<T> &rights, std::mt19937 &e) {
 
 template struct bimap<int, non_default_constructible>;
 template struct bimap<non_default_constructible, int>;
+template class compact_bimap<int, non_default_constructible>;
+template class compact_bimap<non_default_constructible, int>;
+template class small_bimap<int, non_default_constructible>;
+template class small_bimap<non_default_constructible, int>;
+template class multi_index<int, non_default_constructible, std::string>;
 
 static constexpr uint32_t seed = 1488228;
 